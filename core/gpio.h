@@ -47,7 +47,7 @@ typedef struct
 
 // test if gpio is an output
 #define _IS_OUT_GPIO_(_bit, _port, _ddr, _pin) (*(_ddr) & (_bit))
-#define IS_OUT_GPIO(...) _OUT_GPIO_(__VA_ARGS__)
+#define IS_OUT_GPIO(...) _IS_OUT_GPIO_(__VA_ARGS__)
 
 // make gpio an input
 #define _IN_GPIO_(_bit, _port, _ddr, _pin) (*(_ddr) &= (uint8_t)~(_bit))
@@ -68,3 +68,9 @@ typedef struct
 // toggle gpio output/pullup
 #define _TOG_GPIO_(_bit, _port, _ddr, _pin) (*(_pin) = (_bit))
 #define TOG_GPIO(...) _TOG_GPIO_(__VA_ARGS__)
+
+// get gpio port register or bit mask, e.g. to compare pins at compile time
+#define _PORT_GPIO_(_bit, _port, _ddr, _pin) (_port)
+#define PORT_GPIO(...) _PORT_GPIO_(__VA_ARGS__)
+#define _BIT_GPIO_(_bit, _port, _ddr, _pin) (_bit)
+#define BIT_GPIO(...) _BIT_GPIO_(__VA_ARGS__)
@@ -27,21 +27,27 @@ static void start(void)
   #if TICKMS==1
     TCCR2B = 4;                             // 8 Mhz, 1 mS: div=64, count=125
     OCR2A = 124;
+    #define COUNT_SHIFT 3                   // 8 uS per count
   #elif TICKMS==2
     TCCR2B = 5;                             // 8 Mhz, 2 mS: div=128, count=125
     OCR2A = 124;
+    #define COUNT_SHIFT 4                   // 16 uS per count
   #elif TICKMS<=4
     TCCR2B = 6;                             // 8 Mhz, 4 mS: div=256, count=125
     OCR2A = 124;
+    #define COUNT_SHIFT 5                   // 32 uS per count
   #elif TICKMS<=8
     TCCR2B = 6;                             // 8 Mhz, 8 mS: div=256, count=250
     OCR2A = 249;
+    #define COUNT_SHIFT 5                   // 32 uS per count
   #elif TICKMS<=16
     TCCR2B = 7;                             // 8 Mhz, 16 mS: div=1024, count=125
     OCR2A = 124;
+    #define COUNT_SHIFT 7                   // 128 uS per count
   #elif TICKMS<=32
     TCCR2B = 7;                             // 8 Mhz, 32 mS: div=1024, count=250
     OCR2A = 249;
+    #define COUNT_SHIFT 7                   // 128 uS per count
   #else
     #error Max TICKMS is 32 mS
   #endif
@@ -49,18 +55,23 @@ static void start(void)
   #if TICKMS==1
     TCCR2B = 5;                             // 16 Mhz, 1 mS: div=128, count=125
     OCR2A = 124;
+    #define COUNT_SHIFT 3                   // 8 uS per count
   #elif TICKMS==2
     TCCR2B = 6;                             // 16 Mhz, 2 mS: div=256, count=125
     OCR2A = 124;
+    #define COUNT_SHIFT 4                   // 16 uS per count
   #elif TICKMS<=4
     TCCR2B = 6;                             // 16 Mhz, 4 mS: div=256, count=250
     OCR2A = 249;
+    #define COUNT_SHIFT 4                   // 16 uS per count
   #elif TICKMS<=8
     TCCR2B = 7;                             // 16 Mhz, 8 mS: div=1024, count=125
     OCR2A = 124;
+    #define COUNT_SHIFT 6                   // 64 uS per count
   #elif TICKMS<=16
     TCCR2B = 7;                             // 16 Mhz, 16 mS: div=1024, count=250
     OCR2A = 249;
+    #define COUNT_SHIFT 6                   // 64 uS per count
   #else
     #error Max TICKMS is 16 mS
   #endif
@@ -195,6 +206,22 @@ void sleep_ticks(int32_t t)
 }
 #endif
 
+// Return microseconds since boot, in steps of one TIMER2 count
+uint32_t get_micros(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t c=TCNT2;
+    uint32_t t=ticks;
+    if (TIFR2 & (1<<OCF2A))                 // count wrapped but interrupt is pending
+    {
+        c=TCNT2;
+        t+=TICKMS;
+    }
+    SREG = sreg;
+    return ((t/TICKMS)*(OCR2A+1) + c) << COUNT_SHIFT;
+}
+
 // Return current tick count
 uint32_t get_ticks(void)
 {
@@ -7,6 +7,10 @@ void init_ticks(void);
 // Return ticks (aka milliseconds) since boot
 uint32_t get_ticks(void);
 
+// Return microseconds since boot, with 8 to 128 uS resolution depending on
+// MHZ and TICKMS. Can be called from an ISR. Wraps after about 70 minutes.
+uint32_t get_micros(void);
+
 // Suspend calling thread for specified ticks.
 void sleep_ticks(int32_t ticks);
 
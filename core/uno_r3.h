@@ -31,6 +31,10 @@
 #define PWM2        GPIO09 // OC1A
 #define PWM3        GPIO10 // OC1B
 
+// Map pins for TWI
+#define TWI_SDA     GPIOA4
+#define TWI_SCL     GPIOA5
+
 // Map pins for SPI
 #define SPI_SS      GPIO10
 #define SPI_MOSI    GPIO11
@@ -1,18 +1,24 @@
-// PWM demo
+// DHT demo
 #define LED GPIO13                              // on-board LED
 
+dht sensor = { .pin=(gpio []){{GPIO04}}, .type=DHT11 };
+
 int main(void)
 {
     OUT_GPIO(LED);
     init_ticks();
     init_serial();
+    init_dht(&sensor);
     while(true)
     {
-        sleep_ticks(2000);
+        uint8_t err=read_dht(&sensor);          // waits until the sensor allows
         TOG_GPIO(LED);
-        uint8_t dc, rh, err;
-        err=get_dht11(&dc, &rh, (gpio []){{GPIO04}});
         if (err) pprintf("Error %d\n", err);
-        else pprintf("%dC, %d%% humidity\n", dc, rh);
+        else
+        {
+            int16_t t=sensor.temperature;
+            if (t < 0) pprintf("-"), t=-t;
+            pprintf("%d.%dC, %d.%d%% humidity\n", t/10, t%10, sensor.humidity/10, sensor.humidity%10);
+        }
     }
 }
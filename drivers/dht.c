@@ -0,0 +1,131 @@
+// DHT11/DHT22 temp/humidity sensor driver
+
+// The host pulls the data line low to start, the sensor responds by pulling
+// low for 80uS then high for 80uS, then sends 40 bits, each low for 50uS then
+// high for 28uS (zero) or 70uS (one). The falling edges are timestamped with
+// get_micros(), so each bit is the time from one falling edge to the next,
+// about 78uS for a zero and 120uS for a one.
+
+// Needs get_micros() resolution of 16uS or better
+#if (MHZ == 16 && TICKMS > 4) || (MHZ == 8 && TICKMS > 2)
+#error "dht requires TICKMS 4 or less (2 or less at 8 MHz)"
+#endif
+
+#define EDGES 42                        // response, start of first bit, end of each bit
+#define ONE 100                         // longer bits are ones
+
+static volatile uint8_t edges;          // falling edges seen
+static uint32_t last;                   // time of the last one
+static uint8_t data[5];
+
+#ifdef THREAD
+static semaphore mutex = available(1);  // one transfer at a time
+static dht *sensors;                    // sampled sensors
+static semaphore added;                 // released by init_dht()
+#endif
+
+// Data pin changed state, in interrupt context
+static void edge(uint8_t state)
+{
+    if (state || edges >= EDGES) return;
+    uint32_t now = get_micros();
+    uint8_t e = edges++;
+    if (e >= 2)
+    {
+        uint8_t b = e - 2;
+        data[b/8] = (data[b/8] << 1) | (now - last > ONE);
+    }
+    last = now;
+}
+
+// Read the sensor now
+uint8_t read_dht(dht *d)
+{
+    sleep_until(d->allowed);
+#ifdef THREAD
+    suspend(&mutex);
+#endif
+    out_gpio(d->pin);
+    clr_gpio(d->pin);                   // go low, 18 mS for DHT11 or 1 mS for DHT22
+    sleep_ticks((d->type == DHT22 ? 1 : 18) + TICKMS);
+
+    memset(data, 0, sizeof data);
+    edges = 0;
+    attach_pcint(d->pin, edge);
+    in_gpio(d->pin);                    // then back to input
+    set_gpio(d->pin);                   // pull up
+    sleep_ticks(6 + TICKMS);            // transfer takes about 5 mS
+    attach_pcint(d->pin, NULL);
+#ifdef THREAD
+    release(&mutex);
+#endif
+    d->allowed = get_ticks() + (d->type == DHT22 ? 2000 : 1000);
+
+    uint8_t e = edges;
+    if (!e) return d->error = 1;
+    if (e < EDGES) return d->error = 2;
+    if (((data[0]+data[1]+data[2]+data[3]) & 255) != data[4]) return d->error = 3;
+
+    if (d->type == DHT22)
+    {
+        d->humidity = (data[0] << 8) | data[1];
+        d->temperature = ((data[2] & 0x7f) << 8) | data[3];
+        if (data[2] & 0x80) d->temperature = -d->temperature;
+    }
+    else
+    {
+        // integer and tenths, some DHT11s send tenths of degrees
+        d->humidity = data[0]*10 + data[1];
+        d->temperature = data[2]*10 + (data[3] & 0x7f);
+        if (data[3] & 0x80) d->temperature = -d->temperature;
+    }
+    d->ticks = get_ticks();
+    return d->error = 0;
+}
+
+// Get the last good reading
+bool get_dht(dht *d, int16_t *temperature, uint16_t *humidity)
+{
+    if (!d->ticks) return 0;
+    *temperature = d->temperature;
+    *humidity = d->humidity;
+    return 1;
+}
+
+#ifdef THREAD
+// Suspend until the sensor is read again
+void wait_dht(dht *d)
+{
+    suspend(&d->sampled);
+}
+
+// Read each sensor as often as it allows
+THREAD(dhtsample, 80)
+{
+    while (!sensors) suspend(&added);
+    while (1)
+    {
+        // the sensor read longest ago is next
+        dht *next = sensors;
+        for (dht *d = sensors->next; d; d = d->next)
+            if ((int32_t)(d->allowed - next->allowed) < 0) next = d;
+        read_dht(next);
+        release_all(&next->sampled);
+    }
+}
+#endif
+
+// Init sensor pin
+void init_dht(dht *d)
+{
+    in_gpio(d->pin);
+    set_gpio(d->pin);                   // pull up
+    d->ticks = 0;
+    d->error = 0;
+    d->allowed = get_ticks() + 1000;    // sensor needs a second after power on
+#ifdef THREAD
+    d->next = sensors;
+    sensors = d;
+    release(&added);
+#endif
+}
@@ -0,0 +1,45 @@
+// DHT11 and DHT22 (aka AM2302) temp/humidity sensor driver, requires the
+// pcint driver. The data bits are timed by pin change interrupts, so
+// interrupts are never disabled.
+//
+// In threaded projects, sensors passed to init_dht() are read in the
+// background as often as they allow and get_dht() returns the last good
+// reading immediately. Otherwise the application calls read_dht().
+
+#define DHT11 0
+#define DHT22 1
+
+// A sensor definition
+typedef struct dht
+{
+    gpio *pin;                          // data pin
+    uint8_t type;                       // DHT11 or DHT22
+    int16_t temperature;                // last good reading in tenths of degree C
+    uint16_t humidity;                  // last good reading in tenths of percent RH
+    uint32_t ticks;                     // when it was read, 0 if never
+    uint8_t error;                      // result of the last read, 0 if good
+    uint32_t allowed;                   // next read allowed at this tick, managed by the driver
+#ifdef THREAD
+    semaphore sampled;                  // released after each background read
+    struct dht *next;                   // next sampled sensor, managed by the driver
+#endif
+} dht;
+
+// Init sensor pin, and in threaded projects start sampling it
+void init_dht(dht *d);
+
+// Read the sensor now, waiting if it was read too recently (1 second for
+// DHT11, 2 seconds for DHT22, and after power on). Return 0 and update the
+// reading, or return non-zero on error:
+//      1 - the sensor didn't respond
+//      2 - the transfer was incomplete
+//      3 - checksum error
+uint8_t read_dht(dht *d);
+
+// Get the last good reading, return false if there isn't one yet
+bool get_dht(dht *d, int16_t *temperature, uint16_t *humidity);
+
+#ifdef THREAD
+// Suspend until the background sampler next reads the sensor
+void wait_dht(dht *d);
+#endif
@@ -0,0 +1,214 @@
+// IR transmitter via TIMER0. The carrier is generated by the hardware in fast
+// PWM mode on OC0B, the compare match interrupt counts carrier periods and
+// connects or disconnects OC0B at the start of each mark or space.
+
+#ifdef USE_PWM_TIMER0
+#error "irtx conflicts with USE_PWM_TIMER0"
+#endif
+
+// IRTX_HZ sets the carrier frequency
+#ifndef IRTX_HZ
+#define IRTX_HZ 38000
+#endif
+
+// Timer runs at clock/8, period is TOP+1 timer ticks with 1/3 duty cycle
+#define TOP ((MHZ*1000000UL/8 + IRTX_HZ/2) / IRTX_HZ - 1)
+#if TOP > 255
+#error "IRTX_HZ is too low"
+#endif
+#define DUTY ((TOP+1)/3)
+
+// Converts microseconds to carrier periods
+#define periods(us) (uint16_t)(((uint32_t)(us)*MHZ + 4*(TOP+1)) / (8*(TOP+1)))
+
+// NEC timings, see nec.c
+#define HDR_MARK periods(9000)
+#define HDR_SPACE periods(4500)
+#define RPT_SPACE periods(2250)
+#define BIT_MARK periods(560)
+#define ZERO_SPACE periods(560)
+#define ONE_SPACE periods(1690)
+#define FRAME periods(108000)                           // frames start every 108 mS
+
+#define OC0B_PIN PWM1
+
+// frame queue
+#define FRAMES 4
+typedef struct
+{
+    uint8_t repeats;                                    // repeats still to send
+    uint32_t code;                                      // NEC code
+#ifdef IR_PULSES
+    const irtemplate *t;                                // or NULL if NEC
+    uint16_t gap;                                       // space after template, in periods
+    uint16_t widths[IR_WIDTHS];                         // template widths in periods
+#endif
+} frame;
+static frame frames[FRAMES];
+static volatile uint8_t head, count;
+
+#ifdef THREAD
+static semaphore idle;                                  // released when the queue drains
+#endif
+
+static volatile uint16_t remaining;                     // periods remaining in current pulse
+static uint16_t elapsed;                                // periods since start of frame
+static uint8_t position;                                // index of next pulse in frame
+static bool repeating;                                  // true if sending a repeat
+static uint32_t bits;                                   // NEC bits not yet sent
+
+// Return the length of the next pulse in periods and whether it's a mark, or
+// 0 at the end of frame.
+static uint16_t pulse(frame *f, bool *mark)
+{
+    uint8_t i = position++;
+    *mark = !(i & 1);
+
+#ifdef IR_PULSES
+    if (f->t)
+    {
+        if (i < f->t->count) return f->widths[(f->t->pulse[i/2] >> ((i & 1) * 4)) & 15];
+        *mark = 0;
+        return (i == f->t->count) ? f->gap : 0;
+    }
+#endif
+
+    if (!i) return HDR_MARK;
+    if (i == 1)
+    {
+        bits = f->code;
+        return repeating ? RPT_SPACE : HDR_SPACE;
+    }
+    uint8_t last = repeating ? 2 : 66;                  // index of the postamble mark
+    if (i <= last)
+    {
+        if (*mark) return BIT_MARK;
+        bool one = bits & 1;
+        bits >>= 1;
+        return one ? ONE_SPACE : ZERO_SPACE;
+    }
+    *mark = 0;
+    if (i == last+1 && elapsed < FRAME) return FRAME - elapsed; // pad to the frame period
+    return 0;
+}
+
+// Start the next pulse, interrupts must be disabled
+static void next(void)
+{
+    while (count)
+    {
+        frame *f = &frames[head];
+        bool mark;
+        uint16_t n = pulse(f, &mark);
+        if (n)
+        {
+            if (mark) TCCR0A |= 1 << COM0B1;            // connect OC0B
+            else TCCR0A &= (uint8_t)~(1 << COM0B1);     // or disconnect, pin goes low
+            remaining = n;
+            elapsed += n;
+            return;
+        }
+
+        // end of frame
+        position = 0;
+        elapsed = 0;
+        if (f->repeats)
+        {
+            f->repeats--;
+            repeating = 1;
+            continue;
+        }
+        repeating = 0;
+        head = (head+1) % FRAMES;
+        count--;
+    }
+
+    // queue is empty
+    TIMSK0 = 0;
+    TCCR0A = 0;
+    TCCR0B = 0;
+#ifdef THREAD
+    release(&idle);
+#endif
+}
+
+// Called at the end of each carrier pulse, when OC0B has gone low
+ISR(TIMER0_COMPB_vect)
+{
+    if (!--remaining) next();
+}
+
+// Add a frame to the queue and start the timer if idle. Return false if the
+// queue is full.
+static bool queue(frame *f)
+{
+    uint8_t sreg = SREG;
+    cli();
+    if (count == FRAMES)
+    {
+        SREG = sreg;
+        return 0;
+    }
+    frames[(head+count) % FRAMES] = *f;
+    if (!count++)
+    {
+        position = 0;
+        elapsed = 0;
+        repeating = 0;
+        OCR0A = TOP;
+        OCR0B = DUTY;
+        TCNT0 = 0;
+        TCCR0A = (1 << WGM01) | (1 << WGM00);          // fast PWM with TOP = OCR0A
+        TCCR0B = (1 << WGM02) | (1 << CS01);            // clock/8
+        TIFR0 = 1 << OCF0B;
+        TIMSK0 = 1 << OCIE0B;
+        next();                                         // start the first pulse
+    }
+    SREG = sreg;
+    return 1;
+}
+
+// Queue a NEC frame and repeat codes
+bool send_irtx(uint32_t code, uint8_t repeats)
+{
+    frame f = { .repeats = repeats, .code = code };
+    return queue(&f);
+}
+
+#ifdef IR_PULSES
+// Queue a learned template, conversion to periods is done here rather than
+// in the ISR
+bool replay_irtx(const irtemplate *t, uint8_t repeats, uint16_t gap)
+{
+    if (!t->count || t->widths > IR_WIDTHS) return 0;
+    if (gap > 1000) gap = 1000;                         // periods must fit in 16 bits
+    frame f = { .repeats = repeats, .t = t, .gap = periods((uint32_t)gap*1000) };
+    for (uint8_t i = 0; i < t->widths; i++) f.widths[i] = periods(t->width[i]);
+    return queue(&f);
+}
+#endif
+
+// Return true if frames are queued or being sent
+bool busy_irtx(void)
+{
+    return count != 0;
+}
+
+// Wait until all queued frames have been sent
+void wait_irtx(void)
+{
+    sei();                                              // make sure interrupts are enabled
+#ifdef THREAD
+    while (count) suspend(&idle);
+#else
+    while (count);
+#endif
+}
+
+// Init IR transmitter
+void init_irtx(void)
+{
+    wait_irtx();
+    CLR_GPIO(OC0B_PIN);                                 // low when disconnected
+    OUT_GPIO(OC0B_PIN);
+}
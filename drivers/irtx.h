@@ -0,0 +1,24 @@
+// IR transmitter, the LED driver attaches to OC0B (aka PWM1, GPIO05 on UnoR3).
+// Uses TIMER0 so it can't be used with the stepper driver or USE_PWM_TIMER0,
+// but can be used with the nec receiver.
+
+// Init IR transmitter
+void init_irtx(void);
+
+// Queue a NEC frame with specified key code followed by specified number of
+// repeat codes. Return false if the queue is full.
+bool send_irtx(uint32_t code, uint8_t repeats);
+
+#ifdef IR_PULSES
+// Queue a template learned by the nec driver (which must be listed before
+// irtx in DRIVERS) to be sent repeats+1 times, each followed by a space of gap
+// mS (up to 1000). The template must remain valid until sent. Return false if
+// the queue is full.
+bool replay_irtx(const irtemplate *t, uint8_t repeats, uint16_t gap);
+#endif
+
+// Return true if frames are queued or being sent
+bool busy_irtx(void);
+
+// Wait until all queued frames have been sent
+void wait_irtx(void);
@@ -1,26 +1,164 @@
 // LCD module driver, for a controller similar to Samsung KS6600, Hitachi
 // HD44780, etc.
 
-// Send data to display in specified mode and delay for the nominal busy time.
+// Pin access, either through the gpio pointers in the lcd struct or, if LCD_E
+// is defined, statically
+#ifdef LCD_E
+#define set_pin(l, p) SET_GPIO(LCD_##p)
+#define clr_pin(l, p) CLR_GPIO(LCD_##p)
+#define get_pin(l, p) GET_GPIO(LCD_##p)
+#define out_pin(l, p) OUT_GPIO(LCD_##p)
+#define in_pin(l, p) IN_GPIO(LCD_##p)
+#ifdef LCD_RW
+#define has_rw(l) 1
+#endif
+
+// True if D4 to D7 are consecutive bits of one port, so a nibble can be
+// written at once
+#define ONEPORT (PORT_GPIO(LCD_D4) == PORT_GPIO(LCD_D5) && PORT_GPIO(LCD_D4) == PORT_GPIO(LCD_D6) && PORT_GPIO(LCD_D4) == PORT_GPIO(LCD_D7) && \
+                 BIT_GPIO(LCD_D5) == BIT_GPIO(LCD_D4) << 1 && BIT_GPIO(LCD_D6) == BIT_GPIO(LCD_D4) << 2 && BIT_GPIO(LCD_D7) == BIT_GPIO(LCD_D4) << 3)
+#else
+#define set_pin(l, p) set_gpio(l->p)
+#define clr_pin(l, p) clr_gpio(l->p)
+#define get_pin(l, p) get_gpio(l->p)
+#define out_pin(l, p) out_gpio(l->p)
+#define in_pin(l, p) in_gpio(l->p)
+#define has_rw(l) (l->RW != NULL)
+#define ONEPORT 0
+#endif
+
+// Output high nibble of data on D4 to D7
+static inline void nibble(lcd *l, uint8_t data)
+{
+#ifdef LCD_E
+    if (ONEPORT)
+    {
+        uint8_t sreg = SREG;
+        cli();
+        *PORT_GPIO(LCD_D4) = (*PORT_GPIO(LCD_D4) & (uint8_t)~(BIT_GPIO(LCD_D4) * 15)) | (BIT_GPIO(LCD_D4) * (data >> 4));
+        SREG = sreg;
+        return;
+    }
+#endif
+    if (data & 0x10) set_pin(l, D4); else clr_pin(l, D4);
+    if (data & 0x20) set_pin(l, D5); else clr_pin(l, D5);
+    if (data & 0x40) set_pin(l, D6); else clr_pin(l, D6);
+    if (data & 0x80) set_pin(l, D7); else clr_pin(l, D7);
+}
+
+#ifdef has_rw
+// Wait for the busy flag to clear, return false if it's still set after
+// 1.6 mS, longer than any command takes
+static bool ready(lcd *l)
+{
+    in_pin(l, D4);
+    in_pin(l, D5);
+    in_pin(l, D6);
+    in_pin(l, D7);
+    clr_pin(l, RS);
+    set_pin(l, RW);
+    bool busy;
+    uint16_t polls = 400;                       // each takes at least 4 uS
+    do
+    {
+        set_pin(l, E);
+        waituS(1);                              // data is valid after 160nS
+        busy = get_pin(l, D7);                  // busy flag is D7 of the first nibble
+        clr_pin(l, E);
+        waituS(1);
+        set_pin(l, E);                          // ignore the second nibble
+        waituS(1);
+        clr_pin(l, E);
+        waituS(1);
+    } while (busy && --polls);
+    clr_pin(l, RW);
+    out_pin(l, D4);
+    out_pin(l, D5);
+    out_pin(l, D6);
+    out_pin(l, D7);
+    return !busy;
+}
+#endif
+
+// Send data to display in specified mode. If the busy flag can be read, wait
+// for it to clear first, otherwise delay for the nominal busy time after.
 // Note mode & 1 == send 2 nibbles, mode & 2 == assert RS
 #define CMD4 0            // Send 4-bit command only, from data high nibble
 #define CMD8 1            // Send 8-bit command
 #define DATA 3            // Send data (RS high)
 static void send(lcd *l, int8_t mode, uint8_t data)
 {
-    if (mode & 2) set_gpio(l->RS); else clr_gpio(l->RS); // set register select
+#ifdef has_rw
+    if (l->poll && !ready(l)) l->poll = false;  // not responding, use fixed delays from now on
+#endif
+    if (mode & 2) set_pin(l, RS); else clr_pin(l, RS); // set register select
     for (int8_t n=0; n <= (mode & 1); n++, data<<=4)
     {
-        set_gpio(l->E);
-        if (data & 0x10) set_gpio(l->D4); else clr_gpio(l->D4);
-        if (data & 0x20) set_gpio(l->D5); else clr_gpio(l->D5);
-        if (data & 0x40) set_gpio(l->D6); else clr_gpio(l->D6);
-        if (data & 0x80) set_gpio(l->D7); else clr_gpio(l->D7);
-        clr_gpio(l->E);
+        set_pin(l, E);
+        nibble(l, data);
+        clr_pin(l, E);
+        waituS(1);                              // E cycle time
     }
+#ifdef has_rw
+    if (l->poll) return;
+#endif
     waituS(40);
 }
 
+// Set display address to line and column
+#define address(l, line, column) send(l, CMD8, 0x80 + ((line)*0x40) + (column))
+
+#ifdef LCD_BUFFER
+#ifdef THREAD
+static semaphore flushing;                      // released when an LCD needs flushing
+static lcd *buffered;                           // list of LCDs
+
+// Flush LCDs in background, after the writing thread yields
+THREAD(lcdflush, 80)
+{
+    while (true)
+    {
+        suspend(&flushing);
+        for (lcd *l = buffered; l; l = l->next) flush_lcd(l);
+    }
+}
+#endif
+
+// Put character in frame buffer at column of current line, mark it dirty if
+// changed
+static void put_buffer(lcd *l, int8_t column, char c)
+{
+    int8_t cell = l->curl*LCD_COLUMNS + column;
+    if (l->text[cell] == c) return;
+    l->text[cell] = c;
+    l->dirty[cell/8] |= 1 << (cell & 7);
+#ifdef THREAD
+    if (!l->flushing)
+    {
+        l->flushing = true;
+        release(&flushing);
+    }
+#endif
+}
+
+// Send dirty cells to the display, jumping over clean ones
+void flush_lcd(lcd *l)
+{
+    l->flushing = false;
+    for (int8_t line = 0; line < l->lines; line++)
+        for (int8_t column = 0; column < l->columns; column++)
+        {
+            int8_t cell = line*LCD_COLUMNS + column;
+            if (!(l->dirty[cell/8] & (1 << (cell & 7)))) continue;
+            l->dirty[cell/8] &= (uint8_t)~(1 << (cell & 7));
+            if (line != l->atl || column != l->atc) address(l, line, column);
+            send(l, DATA, l->text[cell]);
+            l->atl = line;                      // display address increments
+            l->atc = column+1;
+        }
+}
+#endif
+
 // set lcd line and column
 static void set(lcd *l, int8_t line, int8_t column)
 {
@@ -29,8 +167,10 @@ static void set(lcd *l, int8_t line, int8_t column)
     if (column >= l->columns) line++, column=0;
     if (line < 0) line = l->lines-1;
     if (line >= l->lines) line = 0;
+#ifndef LCD_BUFFER
     // set position
-    send(l, CMD8, 0x80 + (line*0x40) + column);
+    address(l, line, column);
+#endif
     // and remember it
     l->curl=line;
     l->curc=column;
@@ -59,13 +199,21 @@ void write_lcd(lcd *l, int8_t c)
 
         case '\v':              // clear to end of line
             if (l->curc  == l->columns-1) break;
+#ifdef LCD_BUFFER
+            for (int8_t n=l->curc; n < l->columns; n++) put_buffer(l, n, ' ');
+#else
             for (int8_t n=l->curc; n < l->columns; n++) send(l, DATA, ' ');
             set(l, l->curl, l->curc);
+#endif
             break;
 
         default:                // write char and advance
             if (l->curc == l->columns-1) break;
+#ifdef LCD_BUFFER
+            put_buffer(l, l->curc, c);
+#else
             send(l, DATA, c);
+#endif
             l->curc++;
             break;
     }
@@ -81,16 +229,28 @@ void init_lcd(lcd *l)
 {
     // sanity
     if (l->lines < 1) l->lines = 1; else if (l->lines > 2) l->lines = 2;
+#ifdef LCD_BUFFER
+    if (l->columns < 8) l->columns = 8; else if (l->columns > LCD_COLUMNS) l->columns = LCD_COLUMNS;
+#else
     if (l->columns < 8) l->columns = 8; else if (l->columns > 40) l->columns = 40;
+#endif
     l->curc=l->curl=0;
 
     // Pins are outputs
-    out_gpio(l->D4);
-    out_gpio(l->D5);
-    out_gpio(l->D6);
-    out_gpio(l->D7);
-    out_gpio(l->RS);
-    out_gpio(l->E);
+    out_pin(l, D4);
+    out_pin(l, D5);
+    out_pin(l, D6);
+    out_pin(l, D7);
+    out_pin(l, RS);
+    out_pin(l, E);
+#ifdef has_rw
+    l->poll = false;                            // can't until 4-bit mode is set
+    if (has_rw(l))
+    {
+        clr_pin(l, RW);                         // write
+        out_pin(l, RW);
+    }
+#endif
 
     sleep_ticks(50);                            // Allow display 50mS to come out of power-on reset
 
@@ -103,12 +263,30 @@ void init_lcd(lcd *l)
 
     // Initialize into 4-bit mode
     send(l, CMD4, 0x20);                        // set 4-bit interface
+#ifdef has_rw
+    l->poll = has_rw(l);                        // from now on
+#endif
     send(l, CMD8, (l->lines==1) ? 0x20 : 0x28); // function set: 4-bit, N lines, 5x8
     send(l, CMD8, 0x0c);                        // display control: lcd on, cursor off, blink off
     send(l, CMD8, 0x06);                        // entry mode set: cursor increment, no shift
     send(l, CMD8, 0x01);                        // clear display
+#ifdef has_rw
+    if (!l->poll)
+#endif
     waituS(1500);                               // let clear take affect
 
+#ifdef LCD_BUFFER
+    // display is blank and at home
+    memset(l->text, ' ', sizeof l->text);
+    memset(l->dirty, 0, sizeof l->dirty);
+    l->atl = l->atc = 0;
+#ifdef THREAD
+    l->flushing = false;
+    l->next = buffered;
+    buffered = l;
+#endif
+#endif
+
 #ifdef LCD_STDIO
     // prepare handle
     l->handle.put = put;
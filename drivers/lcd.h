@@ -4,11 +4,50 @@
 // if defined, support fprintf(lcd->handle,...) etc 
 #define LCD_STDIO
 
+// If LCD_BUFFER is defined in main.h, writes go to a frame buffer in RAM and
+// only mark the changed characters dirty. Dirty characters are sent by
+// flush_lcd(), which skips over unchanged ones with cursor moves. In threaded
+// projects a background thread calls flush_lcd() after the writing thread
+// yields. Otherwise the application must call it. The buffer is sized for
+// LCD_COLUMNS columns, default 16.
+#ifdef LCD_BUFFER
+#ifndef LCD_COLUMNS
+#define LCD_COLUMNS 16
+#endif
+#if LCD_COLUMNS > 40
+#error "LCD_COLUMNS must be 40 or less"
+#endif
+#endif
+
+// The display's pins are normally given as gpio pointers in the lcd struct.
+// If RW is also given (it can be NULL) the driver polls the busy flag instead
+// of waiting for worst case delays, or falls back to the delays if the flag
+// doesn't clear within 1.6 mS.
+//
+// Or for speed, if LCD_E, LCD_RS, and LCD_D4 to LCD_D7 (and optionally LCD_RW)
+// are defined in main.h as GPIOs, they're accessed statically and the lcd
+// struct has no pins, so only one display is supported. If D4 to D7 are
+// consecutive bits of one port, e.g. GPIO04 to GPIO07, each nibble is written
+// to the port at once.
+
 typedef struct
 {
+#ifndef LCD_E
     gpio *E, *RS, *D4, *D5, *D6, *D7;   // gpios for 6 pins
+    gpio *RW;                           // optional read/write pin, or NULL
+#endif
+#if !defined(LCD_E) || defined(LCD_RW)
+    bool poll;                          // true if polling the busy flag
+#endif
     int8_t lines, columns;              // max lines and columns
     int8_t curl, curc;                  // current line and column
+#ifdef LCD_BUFFER
+    char text[2*LCD_COLUMNS];           // frame buffer
+    uint8_t dirty[(2*LCD_COLUMNS+7)/8]; // bit per character
+    int8_t atl, atc;                    // display's address line and column
+    bool flushing;                      // true if the flush thread is released
+    void *next;                         // next buffered LCD
+#endif
 #ifdef LCD_STDIO
     FILE handle;                        // file handle for stdio
 #endif
@@ -27,3 +66,8 @@ void init_lcd(lcd *l);
 //   \r - move cursor to first column of current line
 //   \v - clear text to end of line
 void write_lcd(lcd *l, int8_t c);
+
+#ifdef LCD_BUFFER
+// Send changed characters to the display
+void flush_lcd(lcd *l);
+#endif
@@ -21,12 +21,30 @@
 // A useful graphic can be found at
 // https://en.wikipedia.org/wiki/Management_Data_Input/Output#/media/File:Miim_timing.svg.
 
+#ifdef MDIO_MDC
+// Static pins. MDC must be high for at least 160 nS. The phy drives MDIO up
+// to 300 nS after the rising edge, and the input synchronizer shows the pin
+// as it was up to 2 cycles before the read, so sample that much later, while
+// MDC is still high.
+#define CYCLES(ns) (((MHZ)*(ns)+999)/1000)              // CPU cycles in ns, rounded up
+#define out(b) ({ if (b) SET_GPIO(MDIO_MDIO); else CLR_GPIO(MDIO_MDIO); SET_GPIO(MDIO_MDC); __builtin_avr_delay_cycles(CYCLES(160)); CLR_GPIO(MDIO_MDC); })
+#define in() ({ SET_GPIO(MDIO_MDC); __builtin_avr_delay_cycles(CYCLES(300)+2); uint8_t _b = GET_GPIO(MDIO_MDIO); CLR_GPIO(MDIO_MDC); _b; })
+#define drive() ({ SET_GPIO(MDIO_MDIO); OUT_GPIO(MDIO_MDIO); CLR_GPIO(MDIO_MDC); OUT_GPIO(MDIO_MDC); })
+#define release() ({ IN_GPIO(MDIO_MDIO); SET_GPIO(MDIO_MDIO); })
+#else
 // Clock out a bit
 #define out(b) ({ if (b) set_gpio(p->MDIO); else clr_gpio(p->MDIO); set_gpio(p->MDC); clr_gpio(p->MDC); })
 
 // Clock in a bit
 #define in() ({ set_gpio(p->MDC); clr_gpio(p->MDC); get_gpio(p->MDIO); })
 
+// Assert MDIO high, MDC low
+#define drive() ({ set_gpio(p->MDIO); out_gpio(p->MDIO); clr_gpio(p->MDC); out_gpio(p->MDC); })
+
+// Switch MDIO to input
+#define release() ({ in_gpio(p->MDIO); set_gpio(p->MDIO); })
+#endif
+
 // mdio opcodes
 #define ISC22 0x80 // set if clause22
 #define ISRD  0x40 // set if read op
@@ -35,18 +53,15 @@
 #define WRITE45  (1)
 #define READ22   (2 | ISRD | ISC22)
 #define READ45   (3 | ISRD)
+#define READINC45 (2 | ISRD) // read then increment address
 
 // Send MDIO frame, possibly return read data depending on opcode
 static int16_t do_mdio(phy *p, uint8_t opcode, int8_t reg, uint16_t data)
 {
-    // assert MDIO high, MDC low
-    set_gpio(p->MDIO);
-    out_gpio(p->MDIO);
-    clr_gpio(p->MDC);
-    out_gpio(p->MDC);
+    drive();
 
-    // start with 32 ones
-    for (uint8_t x=0; x<32; x++) out(1);
+    // start with 32 ones, or one idle bit if the phy allows
+    for (uint8_t x = p->nopreamble ? 31 : 0; x<32; x++) out(1);
 
     // start bits
     out(0);
@@ -65,7 +80,7 @@ static int16_t do_mdio(phy *p, uint8_t opcode, int8_t reg, uint16_t data)
     if (opcode & ISRD)
     {
         // we are reading, switch to input
-        in_gpio(p->MDIO); set_gpio(p->MDIO);
+        release();
 
         // dummy clock
         in();
@@ -91,7 +106,7 @@ static int16_t do_mdio(phy *p, uint8_t opcode, int8_t reg, uint16_t data)
     for (uint16_t n = 0x8000; n; n>>=1) out(data & n);
 
     // leave as input
-    in_gpio(p->MDIO); set_gpio(p->MDIO);
+    release();
 
     // dummy clock
     in();
@@ -99,6 +114,14 @@ static int16_t do_mdio(phy *p, uint8_t opcode, int8_t reg, uint16_t data)
     return 0;
 }
 
+// Send clause 45 address unless the phy already has it
+static void address(phy *p, int32_t reg)
+{
+    if (reg == p->cached) return;
+    do_mdio(p, ADDR45, (uint8_t)(reg>>16), (uint16_t)reg);
+    p->cached = reg;
+}
+
 // Write 16-bit data to phy register
 void inline write_mdio(phy *p, int32_t reg, uint16_t data)
 {
@@ -110,7 +133,7 @@ void inline write_mdio(phy *p, int32_t reg, uint16_t data)
     else
     {
         // write clause 45
-        do_mdio(p, ADDR45, (uint8_t)(reg>>16), (uint16_t)reg);
+        address(p, reg);
         do_mdio(p, WRITE45, (uint8_t)(reg>>16), data);
     }
 }
@@ -126,8 +149,97 @@ uint16_t inline read_mdio(phy *p, int32_t reg)
     } else
     {
         // clause 45
-        do_mdio(p, ADDR45, (uint8_t)(reg>>16), (uint16_t)reg);
+        address(p, reg);
         data=do_mdio(p, READ45, (uint8_t)(reg>>16), 0);
     }
     return data;
 }
+
+// Read consecutive phy registers
+void dump_mdio(phy *p, int32_t reg, uint16_t *data, uint8_t count)
+{
+    if (!count) return;
+    if (reg <= 31)
+    {
+        // clause 22
+        while (count--) *data++=do_mdio(p, READ22, (uint8_t)reg++, 0);
+    } else
+    {
+        // clause 45, the address increments after each read
+        address(p, reg);
+        for (uint8_t n = 0; n < count; n++) *data++=do_mdio(p, READINC45, (uint8_t)(reg>>16), 0);
+        p->cached = (reg & 0xFF0000) | (uint16_t)(reg + count);
+    }
+}
+
+#ifdef MDIO_MONITOR
+static mdio_watch *watches;
+static uint8_t watching;                // number of watches
+static uint16_t period;
+static bool restart;                    // list changed, start a new scan
+static semaphore started;               // released when monitoring starts
+static semaphore changed;               // released when a change is logged
+
+static mdio_change changes[MDIO_LOG];
+static uint8_t logged;                  // total changes, wraps
+
+// Start watching registers
+void monitor_mdio(mdio_watch *w, uint8_t count, uint16_t p)
+{
+    watches = w;
+    watching = count;
+    period = p;
+    restart = 1;
+    if (count) release_one(&started);
+}
+
+// Suspend until a change is logged
+void wait_mdio(void)
+{
+    suspend(&changed);
+}
+
+// Get the next logged change after *position
+bool next_mdio(uint8_t *position, mdio_change *c)
+{
+    if (*position == logged) return 0;
+    if ((uint8_t)(logged - *position) > MDIO_LOG) *position = logged - MDIO_LOG;
+    *c = changes[*position % MDIO_LOG];
+    (*position)++;
+    return 1;
+}
+
+// Scan watched registers, one per yield so other threads keep running
+THREAD(mdiomon, 100)
+{
+    while (1)
+    {
+        while (!watching) suspend(&started);
+        restart = 0;
+        bool primed = 0;
+        while (!restart)
+        {
+            uint32_t t = get_ticks();
+            for (uint8_t i = 0; i < watching && !restart; i++)
+            {
+                mdio_watch *w = &watches[i];
+                uint16_t v = read_mdio(w->p, w->reg) & w->mask;
+                if (primed && v != w->value)
+                {
+                    mdio_change *c = &changes[logged % MDIO_LOG];
+                    c->ticks = get_ticks();
+                    c->watch = i;
+                    c->from = w->value;
+                    c->to = v;
+                    logged++;
+                    release_all(&changed);
+                }
+                w->value = v;
+                yield();
+            }
+            primed = 1;
+            if (!restart) sleep_until(t + period);
+        }
+    }
+}
+#endif
@@ -1,19 +1,85 @@
 // bitbang mdio
 
+// The MDC and MDIO pins are normally given as gpio pointers in the phy struct.
+// Or for speed, if MDIO_MDC and MDIO_MDIO are defined in main.h as GPIOs,
+// they're accessed statically and the phy struct has no pins, so all phys
+// must share one bus.
+
 // A phy definition
 typedef struct
 {
     uint8_t addr;       // physical address 0-31
+#ifndef MDIO_MDC
     gpio *MDC;          // clock gpio
     gpio *MDIO;         // data gpio
+#endif
+    bool nopreamble;    // if true, phy accepts frames without preamble
+    int32_t cached;     // last clause45 address sent, managed by the driver
 } phy;
 
 // Note the register address is either 0-31 for simple 'clause22' mdio, or in
 // form 0xddrrrr for 'clause45' mdio, where dd is the 5-bit device, and rrrr is
 // the 16-bit register address.
+//
+// For clause45 the driver remembers the address last sent to the phy and
+// doesn't send it again, so use one phy struct per phy, and set cached to 0 if
+// anything else may have accessed the phy. If nopreamble is set (only if the
+// phy supports preamble suppression, see register 1 bit 6) frames are sent
+// with a single idle bit instead of the 32-bit preamble.
 
 // Write 16-bit data to phy register
 void write_mdio(phy *p, int32_t reg, uint16_t data);
 
 // Read 16-bit data from phy register
 uint16_t read_mdio(phy *p, int32_t reg);
+
+// Read count consecutive phy registers starting at reg. For clause45 the
+// address is sent once and the phy's post-read-increment is used.
+void dump_mdio(phy *p, int32_t reg, uint16_t *data, uint8_t count);
+
+#ifdef MDIO_MONITOR
+// If MDIO_MONITOR is defined in main.h, a background thread reads a list of
+// watched registers every period, one register per yield. It keeps a shadow
+// of the watched bits, and when any change it logs them with a timestamp and
+// wakes threads in wait_mdio(). The log holds the last MDIO_LOG changes,
+// default 8.
+#ifndef THREAD
+#error "MDIO_MONITOR requires threads"
+#endif
+
+#ifndef MDIO_LOG
+#define MDIO_LOG 8
+#endif
+#if 256 % MDIO_LOG
+#error "MDIO_LOG must be a power of 2"
+#endif
+
+// A watched register
+typedef struct
+{
+    phy *p;             // phy to read
+    int32_t reg;        // register, as for read_mdio
+    uint16_t mask;      // bits to watch, e.g. link status, speed, duplex
+    uint16_t value;     // shadow of watched bits, managed by the monitor
+} mdio_watch;
+
+// A logged change
+typedef struct
+{
+    uint32_t ticks;     // when it was seen
+    uint8_t watch;      // index of the watched register
+    uint16_t from, to;  // old and new watched bits
+} mdio_change;
+
+// Start watching count registers every period ticks, or stop if count is 0.
+// The first scan fills the shadow without logging changes.
+void monitor_mdio(mdio_watch *watches, uint8_t count, uint16_t period);
+
+// Suspend until the monitor logs a change
+void wait_mdio(void);
+
+// Given the caller's log position (initially 0), get the next logged change
+// into *c, advance the position and return true, or return false if there are
+// no new changes. If the caller falls behind, older changes are skipped.
+bool next_mdio(uint8_t *position, mdio_change *c);
+#endif
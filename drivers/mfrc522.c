@@ -2,9 +2,12 @@
 
 // Interesting registers
 #define CommandReg      0x01
+#define ComIEnReg       0x02
+#define DivIEnReg       0x03
 #define ComIrqReg       0x04
 #define ErrorReg        0x06
 #define Status1Reg      0x07
+#define Status2Reg      0x08
 #define FIFODataReg     0x09
 #define FIFOLevelReg    0x0a
 #define ControlReg      0x0c
@@ -17,13 +20,34 @@
 #define TxASKReg        0x15
 #define CRCResultHiReg  0x21
 #define CRCResultLoReg  0x22
+#define ModWidthReg     0x24
 #define RFCfgReg        0x26
+#define TModeReg        0x2a
+#define TPrescalerReg   0x2b
+#define TReloadRegH     0x2c
+#define TReloadRegL     0x2d
 #define VersionReg      0x37
 
 // Interesting commands (written to Command register)
 #define IdleCmd         0x00
 #define CalcCRCCmd      0x03
 #define TranscieveCmd   0x0c
+#define MFAuthentCmd    0x0e
+
+// Interesting ComIrqReg bits
+#define RxIRq           0x20
+#define ErrIRq          0x02
+#define TimerIRq        0x01
+
+// The chip's timer starts when transmission ends and stops when the card
+// starts to answer, it counts in 25uS units (see TPrescalerReg). Cards answer
+// anticollision frames within about 100uS so 1 mS is plenty.
+#define RESPONSE_TIMEOUT 40
+
+// MIFARE Classic cards can take several mS to answer read and write commands,
+// and ISO14443-4 cards have up to about 5 mS to answer RATS.
+#define CLASSIC_TIMEOUT 400
+#define ACTIVATE_TIMEOUT 200
 
 // Typing is boring
 #define u8 uint8_t
@@ -37,52 +61,147 @@ static u8 rb(u8 reg)
     return reg;
 }
 
+// Given an array of count register numbers, read them all in a single SPI
+// transaction and replace each register number with its value.
+static void rregs(u8 *regs, u8 count)
+{
+    for (u8 i=0; i<count; i++) regs[i] = 0x80 | (regs[i]<<1);
+    xfer_spi(regs, count, 1, regs, count);
+}
+
 // Write byte to register
 static void wb(u8 reg, u8 data)
 {
     xfer_spi((u8[]){reg<<1, data}, 2, 0, NULL, 0);
 }
 
-// Read up to rmax bytes from fifo. Return number of bytes that were actually
-// available, whether they were all read or not. Note xfer_spi repeats the last
-// transmitted byte in the case where txdata is shorter than rxdata.
-static u8 rfifo(u8 *data, u8 rmax)
+// Register write list, see wregs()
+#define W(reg, data) 2, (reg)<<1, (data)
+
+// Submit the next segment of the register write list from the SPI ISR
+static u8 *wlist;
+static void wnext(spi_xfer *x)
 {
-    u8 avail = rb(FIFOLevelReg);
-    if (data && avail && rmax)
-        xfer_spi((u8[]){0x80|(FIFODataReg<<1)}, 1, 1, data, (avail < rmax) ? avail : rmax);
-    return avail;
+    u8 n = *wlist;
+    if (!n)                                                     // end of list?
+    {
+#ifdef THREAD
+        release(&x->complete);                                  // wake wregs()
+#endif
+        return;
+    }
+    x->txdata = wlist+1;
+    x->txcount = n;
+    wlist += n+1;
+    submit_spi(x);
+}
+
+// Write a list of registers. Each segment of the list is a byte count,
+// followed by the register address (shifted left) and the data byte(s), a
+// zero count ends the list. The chip requires a separate SPI transaction for
+// each register, but the transactions are chained by the SPI ISR so the
+// thread only waits once.
+static void wregs(u8 *list)
+{
+    spi_xfer x = { .done = wnext };
+    wlist = list;
+    wnext(&x);
+    wait_spi(&x);
 }
 
-// Write count bytes to fifo.
-static void wfifo(u8 *data, u8 count)
+// Read up to rmax bytes from fifo, given the number of bytes available.
+static void rfifo(u8 *data, u8 avail, u8 rmax)
 {
-    wb(FIFOLevelReg, 0x80); // first reset it
-    u8 buf[count+1];
-    buf[0] = FIFODataReg << 1;
-    memcpy(buf+1, data, count);
-    xfer_spi(buf, count+1, 0, NULL, 0);
+    if (data && avail && rmax)
+        xfer_spi((u8[]){0x80|(FIFODataReg<<1)}, 1, 1, data, (avail < rmax) ? avail : rmax);
 }
 
 // Generate CRC of bytes at *data, write the result to *target and
 // return true, or return 0 if error.
 static bool crc(u8 *data, u8 bytes, u8 *target)
 {
-    wb(CommandReg, IdleCmd);
-    wfifo(data, bytes);
-    wb(CommandReg, CalcCRCCmd);
+    u8 list[bytes+12];
+    memcpy(list, (u8[]){W(CommandReg, IdleCmd), W(FIFOLevelReg, 0x80), bytes+1, FIFODataReg<<1}, 8);
+    memcpy(list+8, data, bytes);
+    memcpy(list+8+bytes, (u8[]){W(CommandReg, CalcCRCCmd), 0}, 4);
+    wregs(list);
     int32_t timeout=get_ticks()+10;                             // give it 10 mS
     while (1)
     {
 #ifdef THREAD
         yield();
-#endif  
-        if (rb(Status1Reg) & 0x20) break;                       // until CRC complete
+#endif
+        u8 r[3] = {Status1Reg, CRCResultLoReg, CRCResultHiReg};
+        rregs(r, 3);
+        if (r[0] & 0x20)                                        // CRC complete?
+        {
+            *target++=r[1];                                     // write little-endian CRC to pointer
+            *target=r[2];
+            return 1;                                           // success!
+        }
         if (expired(timeout)) return 0;                         // this really should not happen
     }
-    *target++=rb(CRCResultLoReg);                               // write little-endian CRC to pointer
-    *target=rb(CRCResultHiReg);
-    return 1;                                                   // success!
+}
+
+// Current timer reload value
+static uint16_t fwt = RESPONSE_TIMEOUT;
+
+// Set the chip's response timeout in 25uS units, if it changed
+static void set_timer(uint16_t t)
+{
+    if (t == fwt) return;
+    fwt = t;
+    wregs((u8[]){W(TReloadRegH, t>>8), W(TReloadRegL, t&255), 0});
+}
+
+#if defined(MFRC522_IRQ) && defined(THREAD)
+// Released by the IRQ pin, which goes low on RxIRq or TimerIRq
+static semaphore irq;
+static void irq_handler(u8 state) { if (!state) release(&irq); }
+
+// If the IRQ never arrives (dead chip, miswired pin), release the waiter at
+// its deadline
+static volatile bool waiting;                                   // true while response() is suspended
+static uint32_t deadline;                                       // when to give up on it
+static semaphore armed;                                         // released when waiting starts
+
+THREAD(mfrc522watch, 64)
+{
+    while (1)
+    {
+        while (!waiting) suspend(&armed);
+        sleep_until(deadline);
+        if (waiting && expired(deadline)) release(&irq);
+    }
+}
+#endif
+
+// Wait for the card's response, or for the chip's timer to expire. Return
+// true if RxIRq.
+static bool response(void)
+{
+    int32_t timeout=get_ticks()+(fwt/40)+10;                    // backstop in case chip is dead
+    while(1)
+    {
+#ifdef MFRC522_IRQ
+  #ifdef THREAD
+        deadline = timeout;                                     // wait for IRQ pin or the deadline
+        waiting = 1;
+        release(&armed);
+        suspend(&irq);
+        waiting = 0;
+  #else
+        while (GET_GPIO(MFRC522_IRQ))                           // spin while IRQ pin high
+            if (expired(timeout)) return 0;
+  #endif
+#elif defined(THREAD)
+        yield();
+#endif
+        u8 irqs = rb(ComIrqReg);
+        if (irqs & RxIRq) return 1;                             // loop until RxIRq
+        if (irqs & TimerIRq) return 0;                          // or the chip times out
+        if (expired(timeout)) return 0;                         // or we do
+    }
 }
 
 // Send specified number of txbits from txdata and wait for response. Return 0
@@ -90,30 +209,138 @@ static bool crc(u8 *data, u8 bytes, u8 *target)
 // *data, and return total number of bits received (will be at least 4).
 // rxalign specifies the bit alignment within the first byte of rxdata, used
 // for UID fragment assembly.
+static bool exchanging;
+static void restore(void);
 static s8 transceive(u8 *txdata, u8 txbits, u8 *rxdata, u8 rxmax, u8 rxalign)
 {
-    wb(CommandReg, IdleCmd);
-    wfifo(txdata, (txbits+7)/8);                                // round up to whole bytes
-    wb(ComIrqReg, 0x7F);                                        // reset interrupt status
-    wb(CommandReg, TranscieveCmd);
-    wb(BitFramingReg, 0x80 | ((rxalign&7)<<4) | (txbits&7));    // set StartSend and bit alignment
-    int32_t timeout=get_ticks()+10;                             // give it 10 mS
-    while(1)
-    {
-#ifdef THREAD
-        yield();
-#endif  
-        if (rb(ComIrqReg) & 0x20) break;                        // loop until RxIRq
-        if (expired(timeout)) return 0;                         // or timeout
-    }
-    if (rb(ErrorReg) & 0x13) return -1;                         // BufferOvfl, ParityErr, or ProtocolError
-    u8 rxbytes=rfifo(rxdata, rxmax);                            // get bytes from fifo
+    if (exchanging) restore();                                  // back to plain 106 kbps
+    u8 txbytes = (txbits+7)/8;                                  // round up to whole bytes
+    u8 list[txbytes+18];
+    memcpy(list, (u8[]){W(CommandReg, IdleCmd), W(FIFOLevelReg, 0x80), txbytes+1, FIFODataReg<<1}, 8);
+    memcpy(list+8, txdata, txbytes);
+    memcpy(list+8+txbytes, (u8[]){
+        W(ComIrqReg, 0x7F),                                     // reset interrupt status
+        W(CommandReg, TranscieveCmd),
+        W(BitFramingReg, 0x80 | ((rxalign&7)<<4) | (txbits&7)), // set StartSend and bit alignment
+        0}, 10);
+#if defined(MFRC522_IRQ) && defined(THREAD)
+    while (is_released(&irq)) suspend(&irq);                    // discard stale IRQ
+#endif
+    wregs(list);
+    if (!response()) return 0;
+    u8 r[3] = {ErrorReg, FIFOLevelReg, ControlReg};
+    rregs(r, 3);
+    if (r[0] & 0x13) return -1;                                 // BufferOvfl, ParityErr, or ProtocolError
+    u8 rxbytes=r[1];                                            // bytes in fifo
     if (!rxbytes) return -1;                                    // shouldn't happen
-    uint16_t rxbits=((rxbytes-1)*8)+((rb(ControlReg)&7)?:8);    // calculate actual bits
+    rfifo(rxdata, rxbytes, rxmax);                              // get them
+    uint16_t rxbits=((rxbytes-1)*8)+((r[2]&7)?:8);              // calculate actual bits
     if (rxbits < 4 || rxbits > 127) return -1;                  // shouldn't happen
     return rxbits;
 }
 
+// Data exchange framing, for frame() flags
+#define TXCRC 1                                                 // chip appends CRC to transmitted frame
+#define RXCRC 2                                                 // chip checks and removes CRC of received frame
+#define RXPCB 4                                                 // first received byte goes to rxpcb
+
+static u8 txspeed, rxspeed;                                     // 0-3 for 106, 212, 424, or 848 kbps
+static const u8 modwidth[] = {0x26, 0x15, 0x0a, 0x05};          // ModWidthReg for each tx speed
+static u8 rxpcb;                                                // see RXPCB
+
+// Go back to 106 kbps anticollision framing with crypto off
+static void restore(void)
+{
+    wregs((u8[]){W(TxModeReg, 0), W(RxModeReg, 8), W(ModWidthReg, 0x26), W(Status2Reg, 0), 0});
+    set_timer(RESPONSE_TIMEOUT);
+    txspeed = rxspeed = 0;
+    exchanging = 0;
+}
+
+// Given the number of bytes received so far and the number available in the
+// FIFO, move them to the receive buffer and return the new total. Bytes that
+// don't fit are flushed, the caller detects the overflow from the total.
+static int16_t take(int16_t got, u8 avail, u8 *rx, u8 rxmax, u8 flags)
+{
+    if ((flags & RXPCB) && !got && avail)
+    {
+        rfifo(&rxpcb, avail, 1);                                // first byte is the PCB
+        got++;
+        avail--;
+    }
+    int16_t index = got - ((flags & RXPCB) ? 1 : 0);
+    u8 room = (index < rxmax) ? rxmax-index : 0;
+    if (room) rfifo(rx+index, avail, room);
+    if (avail > room) wb(FIFOLevelReg, 0x80);                   // discard the rest
+    return got+avail;
+}
+
+// Send a frame of whole bytes, starting with first and followed by txbytes
+// from tx, at the current speed and with the specified flags. Receive up to
+// rxmax bytes to rx. Return 0 if timeout, -1 if error, or the number of bits
+// received. The FIFO only holds 64 bytes, so it is refilled while longer
+// frames are sent, and drained while long frames are received. At the higher
+// bit rates this requires a fast SPI clock.
+static int16_t frame(u8 first, u8 *tx, u8 txbytes, u8 *rx, u8 rxmax, u8 flags)
+{
+    u8 n = (txbytes < 63) ? txbytes : 63;                       // what fits in the FIFO with first
+    u8 list[n+28];
+    memcpy(list, (u8[]){
+        W(TxModeReg, ((flags & TXCRC) ? 0x80 : 0) | (txspeed<<4)),
+        W(RxModeReg, ((flags & RXCRC) ? 0x80 : 0) | (rxspeed<<4) | 8),
+        W(ModWidthReg, modwidth[txspeed]),
+        W(CommandReg, IdleCmd),
+        W(FIFOLevelReg, 0x80),
+        n+2, FIFODataReg<<1, first}, 18);
+    memcpy(list+18, tx, n);
+    memcpy(list+18+n, (u8[]){W(ComIrqReg, 0x7F), W(CommandReg, TranscieveCmd), W(BitFramingReg, 0x80), 0}, 10);
+    exchanging = 1;
+#if defined(MFRC522_IRQ) && defined(THREAD)
+    while (is_released(&irq)) suspend(&irq);                    // discard stale IRQ
+#endif
+    wregs(list);
+
+    int32_t timeout=get_ticks()+(fwt/40)+10;                    // backstop in case chip stops sending
+    while (n < txbytes)                                         // refill FIFO until all is sent
+    {
+        u8 r[2] = {ComIrqReg, FIFOLevelReg};
+        rregs(r, 2);
+        if ((r[0] & (ErrIRq|TimerIRq)) || expired(timeout)) return 0;
+        u8 room = 64 - r[1];
+        if (room > 16) room = 16;
+        if (room > txbytes-n) room = txbytes-n;
+        if (!room) continue;
+        u8 chunk[17];
+        chunk[0] = FIFODataReg<<1;
+        memcpy(chunk+1, tx+n, room);
+        xfer_spi(chunk, room+1, 0, NULL, 0);
+        n += room;
+        timeout=get_ticks()+(fwt/40)+10;                        // it's still sending
+    }
+
+    int16_t got = 0;                                            // bytes received
+    if (rxmax > 62)                                             // answer might not fit in the FIFO
+    {
+        int32_t timeout=get_ticks()+(fwt/40)+10;
+        while (1)
+        {
+            u8 r[2] = {ComIrqReg, FIFOLevelReg};
+            rregs(r, 2);
+            if (r[0] & RxIRq) break;                            // done, the rest is in the FIFO
+            if ((r[0] & TimerIRq) || expired(timeout)) return 0;
+            if (r[1]) got = take(got, r[1], rx, rxmax, flags);  // drain it
+        }
+    }
+    else if (!response()) return 0;
+
+    u8 r[3] = {ErrorReg, FIFOLevelReg, ControlReg};
+    rregs(r, 3);
+    if (r[0] & ((flags & RXCRC) ? 0x17 : 0x13)) return -1;     // BufferOvfl, ParityErr, ProtocolError, maybe CRCErr
+    got = take(got, r[1], rx, rxmax, flags);
+    if (!got || got - ((flags & RXPCB) ? 1 : 0) > rxmax) return -1; // nothing, or overflow
+    return ((got-1)*8)+((r[2]&7)?:8);
+}
+
 // Given two arrays, merge 'total' bits from src to the tail of dst starting at
 // bit position 'first'. Note position 0 is the LSB of dst[0], position 8 is
 // the LSB of dst[1], etc. Example, if dst={AA,03}, src={B8,CC,DD,FF}, first=11
@@ -136,17 +363,26 @@ static void merge(u8 *dst, u8 *src, s8 first, s8 total)
 // Send REQA, return true if any card responded.
 static inline bool REQA(void) { return transceive((u8[]){0x26}, 7, NULL, 0, 0) == 16; }
 
+// Send WUPA, return true if any card responded. Unlike REQA, this also wakes
+// cards in the HALT state.
+static inline bool WUPA(void) { return transceive((u8[]){0x52}, 7, NULL, 0, 0) == 16; }
+
 // Send HLTA, to halt the currently selected card so it no longer responds to REQA.
 static inline void HLTA(void) { transceive((u8[]){0x50, 0x00, 0x57, 0xcd}, 32, NULL, 0, 0); };
 
-// Given a pointer to 10-byte UID buffer, try to get UID from card, copy it to
-// the buffer and return 4, 7, or 10 to indicate number of UID bytes. Return 0 if
-// card not present, or some negative number on error...
+// UID and SAK of the last card selected
+static u8 last[10];
+static s8 lastsize;
+static u8 lastsak;
+
+// Given a pointer to 10-byte UID buffer, run anticollision and select one of
+// the cards in the READY state, copy its UID to the buffer and return 4, 7, or
+// 10 to indicate number of UID bytes. If cards collide, the one with the
+// highest UID bit at the first collision is selected. Return some negative
+// number on error...
 #define err(n) -((pass*10)+n)   // ...specifically, this one
-s8 get_mfrc522(u8 *uid)
+static s8 anticollide(u8 *uid)
 {
-    if (!REQA()) return 0;                                      // send REQA to wake up cards in IDLE state
-
     u8 pass=0;
     while(1)                                                    // extract the card's uid, this could take up to 3 passes
     {
@@ -154,7 +390,7 @@ s8 get_mfrc522(u8 *uid)
         while (1)                                               // while we don't have 32 bits yet
         {
             sel[0] = 0x93+(pass*2);                             // send SEL with pass
-            sel[1] = 0x20|nvb;                                  // and the current number of valid bits
+            sel[1] = ((nvb/8+2)<<4)|(nvb&7);                    // and the current number of valid bytes and bits
             u8 rsp[5];                                          // The card responds with the rest, plus a BCC byte
             s8 got = transceive(sel, nvb+16, rsp, 5, nvb&7);    // Expect 40-nvb bits
             if (got <= 0) return err(1);                        // oops, card is gone
@@ -170,6 +406,12 @@ s8 get_mfrc522(u8 *uid)
                 sel[6]=rsp[(got-1)/8];                          // install the bcc
                 break;                                          // and we're out
             }
+            sel[2+nvb/8] |= 1<<(nvb&7);                         // collision, follow the cards with a 1
+            if (++nvb == 32)                                    // in the last bit?
+            {
+                sel[6]=sel[2]^sel[3]^sel[4]^sel[5];             // then generate the bcc
+                break;
+            }
         }
 
         // xor of sel[2] through sel[6] should be zero
@@ -183,8 +425,10 @@ s8 get_mfrc522(u8 *uid)
         if (!crc(sel,7,sel+7)) return err(2);                   // with a CRC in sel[7] and sel[8]
         while(1)
         {
-            s8 got = transceive(sel, 72, NULL, 0, 0);           // send 72 bits
+            u8 sak[3];
+            s8 got = transceive(sel, 72, sak, 3, 0);            // send 72 bits
             if (got <= 0) return err(3);                        // oops, card is gone
+            lastsak = sak[0];
             if (got == 24) break;                               // expect 3 byte SAK
         }
 
@@ -195,8 +439,7 @@ s8 get_mfrc522(u8 *uid)
                 if (sel[2] != 0x88)                             // cascade tag?
                 {
                     memcpy(uid, sel+2, 4);                      // no, UID is 4 bytes
-                    HLTA();                                     // halt the selected card and return
-                    return 4;
+                    goto out;
                 }
                 memcpy(uid, sel+3, 3);                          // else keep three and continue
                 break;
@@ -205,17 +448,272 @@ s8 get_mfrc522(u8 *uid)
                 if (sel[2] != 0x88)                             // cascade tag?
                 {
                     memcpy(uid+3, sel+2, 4);                    // no, append the 4 bytes
-                    HLTA();                                     // halt the selected card
-                    return 7;                                   // 7 bytes total
+                    goto out;                                   // 7 bytes total
                 }
                 memcpy(uid+3, sel+3, 3);                        // else append 3 and continue
                 break;
 
             case 2:                                             // no further cascade is possible
                 memcpy(uid+6, sel+2, 4);                        // append the 4 bytes
-                HLTA();                                         // halt the card
-                return 10;                                      // 10 bytes total
+                goto out;                                       // 10 bytes total
+        }
+    }
+
+  out:
+    lastsize = (pass == 1) ? 4 : (pass == 2) ? 7 : 10;          // remember it
+    memcpy(last, uid, lastsize);
+    return lastsize;
+}
+
+// Given a pointer to 10-byte UID buffer, try to get UID from card, copy it to
+// the buffer and return 4, 7, or 10 to indicate number of UID bytes. Return 0 if
+// card not present, or some negative number on error. The card is halted.
+s8 get_mfrc522(u8 *uid)
+{
+    if (!REQA()) return 0;                                      // send REQA to wake up cards in IDLE state
+    s8 got = anticollide(uid);
+    if (got > 0) HLTA();                                        // halt the selected card
+    return got;
+}
+
+// Given an array of max rfid structs, collect the UIDs of all cards in the
+// field that have not been halted, halting each one. Return the number of
+// cards found.
+s8 inventory_mfrc522(rfid *cards, s8 max)
+{
+    s8 found = 0;
+    for (u8 errors = 0; found < max && errors < 3;)
+    {
+        if (!REQA()) break;                                     // no cards left
+        s8 got = anticollide(cards[found].uid);
+        if (got <= 0)
+        {
+            errors++;                                           // collision trouble or card left
+            continue;
+        }
+        HLTA();                                                 // halt it so the rest can answer
+        cards[found].sak = lastsak;
+        cards[found++].size = got;
+    }
+    return found;
+}
+
+// Given a card UID, wake it and select it directly without anticollision.
+// Return UID size, 0 if card didn't answer, or -1 if error.
+static s8 reselect(rfid *card)
+{
+    if (!WUPA()) return 0;
+    u8 *uid = card->uid;
+    for (u8 pass=0;; pass++)
+    {
+        bool final = pass == (card->size-4)/3;                  // the last cascade level
+        u8 sel[9] = {0x93+(pass*2), 0x70, 0x88};
+        memcpy(sel+(final ? 2 : 3), uid, final ? 4 : 3);        // four bytes, or cascade tag and three bytes
+        uid += final ? 4 : 3;
+        sel[6] = sel[2]^sel[3]^sel[4]^sel[5];
+        if (!crc(sel, 7, sel+7)) return -1;
+        u8 sak[3];
+        if (transceive(sel, 72, sak, 3, 0) != 24) return 0;
+        if (final)
+        {
+            lastsak = sak[0];
+            return card->size;
+        }
+    }
+}
+
+// Return true if the card last returned by get_mfrc522() or
+// inventory_mfrc522() is still in the field. WUPA wakes every card, including
+// halted ones, so select it by its full UID, which only it answers, then halt
+// it again.
+bool present_mfrc522(void)
+{
+    if (!lastsize) return 0;                                    // no card
+    rfid card = { .size = lastsize };
+    memcpy(card.uid, last, lastsize);
+    if (reselect(&card) <= 0) return 0;
+    HLTA();
+    return 1;
+}
+
+// If card->size is 0, select any card that answers REQA and fill in the
+// struct, otherwise wake and select the card with the given UID. The card is
+// left selected for data exchange. Return the UID size, 0 if no card, or
+// negative on error.
+s8 select_mfrc522(rfid *card)
+{
+    s8 got;
+    if (card->size) got = reselect(card);
+    else if (!REQA()) return 0;
+    else got = card->size = anticollide(card->uid);
+    if (got > 0) card->sak = lastsak;
+    else card->size = 0;
+    return got;
+}
+
+// ISO14443-4 state
+static bool iso4;                                               // true if the card is activated
+static u8 bn;                                                   // block number
+static u8 blocksize = 13;                                       // max INF bytes per block
+
+// Halt the selected card
+void halt_mfrc522(void)
+{
+    set_timer(RESPONSE_TIMEOUT);                                // it won't answer
+    if (iso4) frame(0xc2, NULL, 0, NULL, 0, TXCRC|RXCRC);       // S(DESELECT)
+    else frame(0x50, (u8[]){0}, 1, NULL, 0, TXCRC);             // HLTA, encrypted if authenticated
+    iso4 = 0;
+    restore();
+}
+
+// Authenticate MIFARE Classic card for access to the specified block's
+// sector, with key type MIFARE_KEY_A or MIFARE_KEY_B and 6-byte key. Once
+// authenticated the chip encrypts all traffic.
+bool auth_mfrc522(rfid *card, u8 block, u8 type, const u8 *key)
+{
+    u8 list[33];
+    memcpy(list, (u8[]){W(TxModeReg, 0), W(RxModeReg, 8), W(CommandReg, IdleCmd), W(FIFOLevelReg, 0x80),
+                        13, FIFODataReg<<1, type, block}, 16);
+    memcpy(list+16, key, 6);
+    memcpy(list+22, card->uid+card->size-4, 4);                 // last four bytes of UID
+    memcpy(list+26, (u8[]){W(ComIrqReg, 0x7F), W(CommandReg, MFAuthentCmd), 0}, 7);
+    exchanging = 1;
+    wregs(list);
+    int32_t timeout=get_ticks()+10;
+    while (1)
+    {
+#ifdef THREAD
+        yield();
+#endif
+        u8 r[2] = {Status2Reg, ComIrqReg};
+        rregs(r, 2);
+        if (r[0] & 0x08) return 1;                              // MFCrypto1On
+        if ((r[1] & (ErrIRq|TimerIRq)) || expired(timeout)) return 0;
+    }
+}
+
+// Read 16-byte MIFARE Classic block, return true if success
+bool read_mfrc522(u8 block, u8 *data)
+{
+    u8 rsp[18];                                                 // room for CRC, just in case
+    set_timer(CLASSIC_TIMEOUT);
+    if (frame(0x30, &block, 1, rsp, 18, TXCRC|RXCRC) < 128) return 0;
+    memcpy(data, rsp, 16);
+    return 1;
+}
+
+// Write 16-byte MIFARE Classic block, return true if success
+bool write_mfrc522(u8 block, u8 *data)
+{
+    u8 ack;                                                     // 4-bit ACK is 0xA, anything else is NAK
+    set_timer(CLASSIC_TIMEOUT);
+    if (frame(0xa0, &block, 1, &ack, 1, TXCRC) != 4 || (ack & 15) != 10) return 0;
+    return frame(data[0], data+1, 15, &ack, 1, TXCRC) == 4 && (ack & 15) == 10;
+}
+
+// Return the highest bit number (1-3) in the low three bits of mask, or 0
+static u8 highest(u8 mask)
+{
+    return (mask & 4) ? 3 : (mask & 2) ? 2 : mask & 1;
+}
+
+// Activate selected ISO14443-4 card and switch to the highest bit rate both
+// sides support. Return true if success.
+bool open_mfrc522(void)
+{
+    static const u8 sizes[] = {13, 21, 29, 37, 45, 61, 93, 125, 253}; // FSC-3 for each FSCI
+    u8 ats[20];
+    set_timer(ACTIVATE_TIMEOUT);
+    int16_t got = frame(0xe0, (u8[]){0x80}, 1, ats, sizeof ats, TXCRC|RXCRC); // RATS, FSD=256, CID=0
+    if (got < 8 || got % 8 || ats[0] > got/8) return 0;         // TL is the ATS length
+
+    u8 t0 = (ats[0] > 1) ? ats[1] : 0x02, *p = ats+2;           // default FSCI=2
+    u8 ta = (t0 & 0x10) ? *p++ : 0;                             // default 106 kbps only
+    u8 tb = (t0 & 0x20) ? *p++ : 0x40;                          // default FWI=4, SFGI=0
+    blocksize = sizes[((t0 & 15) < 8) ? t0 & 15 : 8];
+    bn = 0;
+    iso4 = 1;
+
+    // FWT is 302uS * 2^FWI, in 25uS units with some margin
+    set_timer(((tb>>4) >= 13) ? 0xffff : (13 << (tb>>4)));
+
+    // SFGT is also 302uS * 2^SFGI, wait for it
+    if (tb & 15) sleep_ticks(((302UL << (tb & 15))/1000)+1);
+
+    // DS in TA bits 4-6 is the card's send speed, DR in bits 0-2 is its
+    // receive speed. If bit 7 is set they must be the same.
+    u8 dsi = highest(ta>>4), dri = highest(ta);
+    if (ta & 0x80) dsi = dri = highest((ta>>4) & ta);
+    if (dsi || dri)
+    {
+        u8 pps;
+        if (frame(0xd0, (u8[]){0x11, (dsi<<2)|dri}, 2, &pps, 1, TXCRC|RXCRC) != 8 || pps != 0xd0)
+            return 1;                                           // PPS refused, stay at 106 kbps
+        txspeed = dri;                                          // new speed applies to the next frame
+        rxspeed = dsi;
+    }
+    return 1;
+}
+
+// Send an ISO14443-4 block with the given PCB and INF, receive the answer's
+// INF to rx and its PCB to rxpcb. Answer waiting time extension requests.
+// Return number of INF bytes received, or -1 if error.
+static int16_t block(u8 pcb, u8 *inf, u8 n, u8 *rx, u8 rxmax)
+{
+    uint16_t t = fwt;
+    while (1)
+    {
+        int16_t got = frame(pcb, inf, n, rx, rxmax, TXCRC|RXCRC|RXPCB);
+        if (got <= 0 || got % 8) break;
+        if ((rxpcb & 0xf7) != 0xf2)                             // not S(WTX)?
+        {
+            set_timer(t);
+            return (got/8)-1;                                   // then done
+        }
+        u8 wtxm = (rxmax && got > 8) ? rx[0] & 0x3f : 1;        // card wants more time
+        set_timer(((uint32_t)t*wtxm > 0xffff) ? 0xffff : t*wtxm);
+        pcb = 0xf2;                                             // and we agree
+        inf = &wtxm;
+        n = 1;
+    }
+    set_timer(t);
+    return -1;
+}
+
+// Exchange data with an ISO14443-4 card activated by open_mfrc522(), send
+// txlen bytes from tx and receive up to rxmax bytes to rx. Chaining is
+// handled in both directions. Return the number of bytes received, or -1 if
+// error.
+int16_t xchg_mfrc522(u8 *tx, u8 txlen, u8 *rx, u8 rxmax)
+{
+    if (!iso4) return -1;
+    int16_t total = 0;
+    u8 pcb = 0, n = 0;
+    while (1)
+    {
+        if (!pcb)                                               // next I-block
+        {
+            n = (txlen > blocksize) ? blocksize : txlen;
+            pcb = 0x02 | bn | ((n < txlen) ? 0x10 : 0);         // with chaining if more to come
+        }
+        int16_t got = block(pcb, tx, n, rx+total, rxmax-total);
+        if (got < 0) return -1;
+        if ((rxpcb & 0xe2) == 0x02)                             // I-block
+        {
+            bn ^= 1;
+            total += got;
+            if (!(rxpcb & 0x10)) return total;                  // the card is done
+            pcb = 0xa2 | bn;                                    // else R(ACK) for more
+            n = 0;
+        }
+        else if ((rxpcb & 0xf6) == 0xa2 && (pcb & 0x10))       // R(ACK) for our chained block
+        {
+            bn ^= 1;
+            tx += n;
+            txlen -= n;
+            pcb = 0;
         }
+        else return -1;
     }
 }
 
@@ -234,5 +732,17 @@ bool init_mfrc522(void)
     wb(RFCfgReg, 0x70);                                         // 48dB receiver gain
     wb(TxModeReg, 0);                                           // 106 kbps transmit
     wb(RxModeReg, 8);                                           // 106 kbps receive, RxNoErr means RxIRq is set only if receive data avaiable
+    wb(TModeReg, 0x80);                                         // TAuto, timer starts when transmission ends
+    wb(TPrescalerReg, 0xa9);                                    // 13.56MHz/(2*169+1) = 40KHz, aka 25uS
+    wb(TReloadRegH, 0);
+    wb(TReloadRegL, RESPONSE_TIMEOUT);
+#ifdef MFRC522_IRQ
+    wb(DivIEnReg, 0x80);                                        // IRQ pin is push-pull
+    wb(ComIEnReg, 0x80 | RxIRq | TimerIRq);                     // active low on RxIRq or TimerIRq
+    IN_GPIO(MFRC522_IRQ);
+  #ifdef THREAD
+    attach_pcint((gpio []){{MFRC522_IRQ}}, irq_handler);
+  #endif
+#endif
     return 1;
 }
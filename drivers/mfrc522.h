@@ -1,3 +1,11 @@
+// MFRC522 RFID reader, attached via SPI. Define MFRC522_RST as the gpio
+// attached to the chip's reset pin.
+//
+// Optionally define MFRC522_IRQ as the gpio attached to the chip's IRQ pin.
+// The driver then waits for the pin instead of polling the chip over SPI. In
+// threaded projects the pin is handled by a pin change interrupt, so the
+// 'pcint' driver is also required.
+
 // Initialize MFRC522 RFID reader and return true, or false if chip fails to
 // respond.
 bool init_mfrc522(void);
@@ -8,3 +16,47 @@ bool init_mfrc522(void);
 // UIDs are not guaranteed to be unique. If a 4-byte UID starts with 0x08 then
 // the other three bytes are randomly generated every time the card is read.
 int8_t get_mfrc522(uint8_t *uid);
+
+// A card UID, size is 4, 7, or 10 bytes
+typedef struct
+{
+    int8_t size;
+    uint8_t uid[10];
+    uint8_t sak;        // select acknowledge, e.g. 0x08 = MIFARE Classic 1K, 0x20 = ISO14443-4
+} rfid;
+
+// Given an array of max rfid structs, find all the cards in the field in one
+// pass and return the number found. Cards are halted after they are found, so
+// a card is reported once until it leaves the field and returns.
+int8_t inventory_mfrc522(rfid *cards, int8_t max);
+
+// Return true if the card last found by get_mfrc522() or inventory_mfrc522()
+// is still in the field, whether or not other cards are. The card is left
+// halted.
+bool present_mfrc522(void);
+
+// If card->size is 0, select any card in the field and fill in the struct.
+// Otherwise wake and select the card with the given UID, e.g. one found by
+// inventory_mfrc522(). Return the UID size, 0 if no card, or negative on
+// error. The card stays selected for the functions below until halted.
+int8_t select_mfrc522(rfid *card);
+
+// Halt the selected card.
+void halt_mfrc522(void);
+
+// MIFARE Classic: authenticate the sector containing block with the 6-byte
+// key, then read or write 16-byte blocks in that sector. All return true if
+// success.
+#define MIFARE_KEY_A 0x60
+#define MIFARE_KEY_B 0x61
+bool auth_mfrc522(rfid *card, uint8_t block, uint8_t type, const uint8_t *key);
+bool read_mfrc522(uint8_t block, uint8_t *data);
+bool write_mfrc522(uint8_t block, uint8_t *data);
+
+// ISO14443-4: activate the selected card (if card->sak & 0x20) and switch to
+// the highest bit rate both sides support, return true if success. Then
+// exchange data (e.g. APDUs) with the card, return number of bytes received
+// or -1 if error. Frames longer than the chip's 64-byte FIFO are pipelined,
+// which at 424 kbps and up requires a fast SPI_CLOCK.
+bool open_mfrc522(void);
+int16_t xchg_mfrc522(uint8_t *tx, uint8_t txlen, uint8_t *rx, uint8_t rxmax);
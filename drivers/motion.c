@@ -0,0 +1,378 @@
+// Coordinated stepper motion via TIMER1 in CTC mode with TOP=OCR1A, at
+// clock/8. The compare interrupt makes one step of the longest axis per
+// period, and adjusts the period ACCEL_HZ times per second to accelerate or
+// decelerate. Rates are planned as squares (v^2 = u^2 + 2as) to avoid square
+// roots.
+
+#ifndef MOTION_AXES
+#error "Must define MOTION_AXES"
+#endif
+
+#ifdef USE_PWM_TIMER1
+#error "motion conflicts with USE_PWM_TIMER1"
+#endif
+
+#ifndef MOTION_ACCEL
+#define MOTION_ACCEL 2000
+#endif
+
+#ifndef MOTION_JERK
+#define MOTION_JERK 200
+#endif
+
+#ifndef MOTION_MAX_HZ
+#define MOTION_MAX_HZ 10000
+#endif
+
+#ifndef MOTION_MOVES
+#define MOTION_MOVES 8
+#endif
+
+#define CLOCK ((MHZ*1000000UL)/8)                   // timer ticks per second
+#if MOTION_JERK <= CLOCK/65536 || MOTION_JERK > MOTION_MAX_HZ
+#error "MOTION_JERK out of range"
+#endif
+#if MOTION_MAX_HZ > 20000
+#error "MOTION_MAX_HZ out of range"
+#endif
+
+// Rate is updated this often
+#define ACCEL_HZ 200
+#define ACCEL_TICKS (CLOCK/ACCEL_HZ)
+#define DV ((MOTION_ACCEL+ACCEL_HZ/2)/ACCEL_HZ)     // rate change per update
+#define AHEAD ((65536UL+ACCEL_HZ-1)/ACCEL_HZ)       // rate*AHEAD>>16 is steps per update, rounded up
+#if DV < 1
+#error "MOTION_ACCEL is too low"
+#endif
+
+#define ACCEL2 (2UL*MOTION_ACCEL)
+#define START2 ((uint32_t)MOTION_JERK*MOTION_JERK)
+#define MAX2 ((uint32_t)MOTION_MAX_HZ*MOTION_MAX_HZ)
+
+static const motion_axis config[] PROGMEM = { MOTION_AXES };
+#define AXES (sizeof(config)/sizeof(motion_axis))
+
+// Pins, for STEP/DIR axes pin 0 is STEP and 1 is DIR
+static struct
+{
+    volatile uint8_t *port;
+    uint8_t bit;
+} pins[AXES][4];
+static uint8_t unipolar;                            // bit per axis
+
+#define NORTH 1
+#define EAST 2
+#define SOUTH 4
+#define WEST 8
+static const uint8_t phases[8] = { NORTH, NORTH|EAST, EAST, SOUTH|EAST, SOUTH, SOUTH|WEST, WEST, NORTH|WEST };
+static uint8_t phase[AXES];                         // current phase of unipolar axes
+
+typedef struct
+{
+    uint32_t delta[AXES];                           // steps for each axis
+    uint8_t backward;                               // bit per axis
+    uint32_t steps;                                 // steps of the longest axis
+    uint16_t cruise;                                // requested rate
+    uint32_t max2;                                  // max entry rate squared, where it joins the previous
+    uint32_t entry2;                                // planned entry rate squared
+} move;
+
+static move moves[MOTION_MOVES];
+static volatile uint8_t head, count;
+#ifdef THREAD
+static semaphore moved;                             // released as each move completes
+#endif
+
+static volatile int32_t position[AXES];             // current position
+static int32_t planned[AXES];                       // position at end of queue
+static int16_t unit[AXES];                          // direction of last queued move, 2.14 fixed point
+
+// Interrupt state
+static int32_t error[AXES];                         // Bresenham error terms
+static uint32_t done;                               // steps done in current move
+static uint16_t rate;                               // current step rate
+static uint16_t interval;                           // current timer period
+static uint16_t elapsed;                            // ticks since last rate update
+
+// Output coils of unipolar axis
+static void coils(uint8_t a, uint8_t p)
+{
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        if (p & (1 << i)) *pins[a][i].port |= pins[a][i].bit;
+        else *pins[a][i].port &= (uint8_t)~pins[a][i].bit;
+    }
+}
+
+// Prepare to start move at head, interrupts must be disabled
+static void begin(void)
+{
+    move *m = &moves[head];
+    for (uint8_t a = 0; a < AXES; a++)
+    {
+        error[a] = m->steps / 2;
+        if (unipolar & (1 << a)) continue;
+        if (m->backward & (1 << a)) *pins[a][1].port |= pins[a][1].bit;
+        else *pins[a][1].port &= (uint8_t)~pins[a][1].bit;
+    }
+    done = 0;
+}
+
+// Return v2 + 2as without overflow
+static uint32_t reach(uint32_t v2, uint32_t steps)
+{
+    if (steps >= (0xFFFFFFFF - v2) / ACCEL2) return 0xFFFFFFFF;
+    return v2 + ACCEL2 * steps;
+}
+
+// Return CLOCK/rate, rounded. The quotient fits in 16 bits, so this is 16
+// steps of long division instead of a general 32-bit divide.
+static uint16_t period(uint16_t rate)
+{
+    uint32_t r = CLOCK >> 16;                       // less than rate
+    uint16_t low = (uint16_t)CLOCK, q = 0;
+    for (uint8_t i = 0; i < 16; i++)
+    {
+        r = (r << 1) | (low >> 15);
+        low <<= 1;
+        q <<= 1;
+        if (r >= rate) r -= rate, q |= 1;
+    }
+    if (r << 1 >= rate) q++;                        // truncating would run fast
+    return q;
+}
+
+// Adjust rate toward cruise, or toward the exit rate when it's time to slow
+// down. Interrupt context, so no 32-bit divides.
+static void accelerate(move *m)
+{
+    uint32_t exit2 = (count > 1) ? moves[(head+1) % MOTION_MOVES].entry2 : START2;
+    uint32_t remaining = m->steps - done;
+    uint16_t old = rate;
+
+    // the rate until the next update if not slowing down
+    uint16_t next = (rate + DV < m->cruise) ? rate + DV : m->cruise;
+    uint32_t r2 = (uint32_t)next * next;
+
+    // steps left at the next update, which is too late if slowing must start
+    // before then
+    uint16_t ahead = ((uint32_t)next * AHEAD >> 16) + 1;
+    remaining = (remaining > ahead) ? remaining - ahead : 0;
+
+    // (r2 - exit2) / ACCEL2 >= remaining, r2 is at most MAX2
+    if (r2 > exit2 && remaining <= MAX2 / ACCEL2 && r2 - exit2 >= ACCEL2 * remaining)
+        rate = (rate > MOTION_JERK + DV) ? rate - DV : MOTION_JERK;
+    else rate = next;
+    if (rate != old) interval = period(rate);       // not while cruising
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+    // end previous STEP pulses
+    for (uint8_t a = 0; a < AXES; a++)
+        if (!(unipolar & (1 << a))) *pins[a][0].port &= (uint8_t)~pins[a][0].bit;
+
+    if (!count)
+    {
+        // one period after the last step, stop
+        TCCR1B = 0;
+        TIMSK1 = 0;
+        for (uint8_t a = 0; a < AXES; a++)
+            if (unipolar & (1 << a)) coils(a, 0);
+        return;
+    }
+
+    move *m = &moves[head];
+    for (uint8_t a = 0; a < AXES; a++)
+    {
+        error[a] -= m->delta[a];
+        if (error[a] >= 0) continue;
+        error[a] += m->steps;
+        bool back = m->backward & (1 << a);
+        if (back) position[a]--; else position[a]++;
+        if (unipolar & (1 << a))
+        {
+            if (back) phase[a]--; else phase[a]++;
+            coils(a, phases[phase[a] & 7]);
+        }
+        else *pins[a][0].port |= pins[a][0].bit;    // start STEP pulse
+    }
+
+    if (++done == m->steps)
+    {
+        // next move
+        head = (head + 1) % MOTION_MOVES;
+        count--;
+#ifdef THREAD
+        release(&moved);
+#endif
+        if (!count) return;                         // stop at the next interrupt, after the STEP pulse
+        begin();
+        m = &moves[head];
+    }
+
+    elapsed += interval;
+    if (elapsed >= ACCEL_TICKS)
+    {
+        elapsed -= ACCEL_TICKS;
+        accelerate(m);
+        OCR1A = interval - 1;                       // not buffered in CTC mode
+        if (TCNT1 > interval - 3) TCNT1 = interval - 3; // count passed it, match soon instead of after a wrap
+    }
+}
+
+// Replan entry rates after a move is queued, interrupts must be disabled.
+// Appending a move only raises the exit rate of the move before it, so the
+// interrupt never sees a rate drop that it can't achieve.
+static void plan(void)
+{
+    if (count < 2) return;                          // nothing to plan, the head is running
+
+    // backward pass, ensure each move can slow to the next's entry rate
+    uint32_t exit2 = START2;
+    for (uint8_t n = count - 1; n; n--)
+    {
+        move *m = &moves[(head + n) % MOTION_MOVES];
+        uint32_t e = reach(exit2, m->steps);
+        m->entry2 = (e < m->max2) ? e : m->max2;
+        exit2 = m->entry2;
+    }
+
+    // forward pass, ensure each entry rate can be reached from the one before
+    move *m = &moves[head];
+    uint32_t entry2 = reach((uint32_t)rate * rate, m->steps - done);
+    for (uint8_t n = 1; n < count; n++)
+    {
+        m = &moves[(head + n) % MOTION_MOVES];
+        if (m->entry2 > entry2) m->entry2 = entry2;
+        entry2 = reach(m->entry2, m->steps);
+    }
+}
+
+// Queue a move to absolute target position
+void move_motion(const int32_t *target, uint16_t hz)
+{
+    move m;
+    memset(&m, 0, sizeof m);
+    for (uint8_t a = 0; a < AXES; a++)
+    {
+        int32_t d = target[a] - planned[a];
+        if (d < 0) m.backward |= 1 << a, d = -d;
+        m.delta[a] = d;
+        if (m.delta[a] > m.steps) m.steps = m.delta[a];
+    }
+    if (!m.steps) return;
+    if (hz < MOTION_JERK) hz = MOTION_JERK;
+    if (hz > MOTION_MAX_HZ) hz = MOTION_MAX_HZ;
+    m.cruise = hz;
+
+    // direction as unit vector (of the longest axis), the largest change of
+    // any axis at the junction must be no more than MOTION_JERK
+    uint16_t diff = 0;
+    uint32_t shift = m.steps;
+    uint8_t s = 0;
+    while (shift >> 16) shift >>= 1, s++;
+    for (uint8_t a = 0; a < AXES; a++)
+    {
+        int16_t u = ((m.delta[a] >> s) << 14) / shift;
+        if (m.backward & (1 << a)) u = -u;
+        uint16_t d = (u > unit[a]) ? u - unit[a] : unit[a] - u;
+        if (d > diff) diff = d;
+        unit[a] = u;
+    }
+    uint32_t r = diff ? ((uint32_t)MOTION_JERK << 14) / diff : 0xFFFF;
+    if (r > m.cruise) r = m.cruise;
+    m.max2 = r * r;
+    m.entry2 = START2;
+
+    // wait for space in queue
+    sei();
+#ifdef THREAD
+    while (count == MOTION_MOVES) suspend(&moved);
+#else
+    while (count == MOTION_MOVES);
+#endif
+
+    for (uint8_t a = 0; a < AXES; a++) planned[a] = target[a];
+
+    cli();
+    if (count && moves[(head + count - 1) % MOTION_MOVES].cruise < r)
+    {
+        // previous move is slower
+        r = moves[(head + count - 1) % MOTION_MOVES].cruise;
+        m.max2 = r * r;
+    }
+    moves[(head + count) % MOTION_MOVES] = m;
+    if (!count++)
+    {
+        // start from rest
+        begin();
+        rate = MOTION_JERK;
+        interval = period(rate);
+        elapsed = 0;
+        TCCR1A = 0;
+        TCCR1B = 0;
+        TCNT1 = 0;
+        OCR1A = interval - 1;
+        TIFR1 = 1 << OCF1A;
+        TIMSK1 = 1 << OCIE1A;
+        TCCR1B = 0x08 | 2;                          // CTC mode 4, TOP=OCR1A, clock/8
+    }
+    else plan();
+    sei();
+}
+
+// Return true if moving
+bool running_motion(void)
+{
+    return count != 0;
+}
+
+// Wait for all moves to finish
+void wait_motion(void)
+{
+    sei();
+#ifdef THREAD
+    while (count) suspend(&moved);
+#else
+    while (count);
+#endif
+}
+
+// Return current position of axis
+int32_t get_motion(uint8_t axis)
+{
+    if (axis >= AXES) return 0;
+    uint8_t sreg = SREG;
+    cli();
+    int32_t p = position[axis];
+    SREG = sreg;
+    return p;
+}
+
+// Set all positions to 0
+void zero_motion(void)
+{
+    if (count) return;
+    for (uint8_t a = 0; a < AXES; a++) position[a] = planned[a] = 0;
+}
+
+// Init pins
+void init_motion(void)
+{
+    for (uint8_t a = 0; a < AXES; a++)
+    {
+        motion_axis c;
+        memcpy_P(&c, &config[a], sizeof c);
+        if (c.unipolar) unipolar |= 1 << a;
+        for (uint8_t i = 0; i < (c.unipolar ? 4 : 2); i++)
+        {
+            pins[a][i].port = c.pin[i].port;
+            pins[a][i].bit = c.pin[i].bit;
+            clr_gpio((&c.pin[i]));
+            out_gpio((&c.pin[i]));
+        }
+        position[a] = planned[a] = 0;
+        unit[a] = 0;
+    }
+}
@@ -0,0 +1,51 @@
+// Coordinated motion for 1 to 4 stepper motor axes, using TIMER1. So it can't
+// be used with USE_PWM_TIMER1, softpwm, servo or the nec driver.
+//
+// Define MOTION_AXES in main.h as a list of axes, each of which is either:
+//      MOTION_STEPDIR(step, dir) - GPIOs for a STEP/DIR driver IC
+//      MOTION_UNIPOLAR(n, e, s, w) - coil GPIOs for a unipolar motor, driven
+//          in half steps as in the stepper driver
+// For example:
+//      #define MOTION_AXES MOTION_STEPDIR(GPIO02, GPIO05), MOTION_UNIPOLAR(GPIO08, GPIO09, GPIO10, GPIO11)
+//
+// Optionally define:
+//      MOTION_ACCEL - acceleration in steps/S/S, default 2000
+//      MOTION_JERK - speed at which the axes can start and stop in steps/S,
+//          also the largest instantaneous speed change of any axis where moves
+//          join, default 200
+//      MOTION_MAX_HZ - maximum step rate, default 10000
+//      MOTION_MOVES - length of the move queue, default 8
+//
+// Moves are queued and executed in the background by the timer interrupt. In
+// each move all axes step in a straight line, using Bresenham's algorithm to
+// interleave the steps of the shorter axes with the longest. Speeds are
+// planned over the whole queue, so moves in similar directions join without
+// slowing down, and the last move decelerates to stop at the end.
+
+typedef struct
+{
+    uint8_t unipolar;
+    gpio pin[4];
+} motion_axis;
+
+#define MOTION_STEPDIR(step, dir) { 0, { {step}, {dir} } }
+#define MOTION_UNIPOLAR(n, e, s, w) { 1, { {n}, {e}, {s}, {w} } }
+
+// Init motion driver, all axes are at position 0
+void init_motion(void);
+
+// Queue a move to absolute target positions in steps, one for each axis, at
+// hz steps per second along the longest axis. Blocks if the queue is full.
+void move_motion(const int32_t *target, uint16_t hz);
+
+// Return true if the axes are moving
+bool running_motion(void);
+
+// Wait until all queued moves have finished
+void wait_motion(void);
+
+// Return current position of axis
+int32_t get_motion(uint8_t axis);
+
+// Set the current position of all axes to 0, does nothing if running
+void zero_motion(void);
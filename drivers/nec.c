@@ -1,4 +1,4 @@
-// Receive NEC IR via timer 1 input capture.
+// Receive IR remote control codes via timer 1 input capture.
 
 // Detector attaches to ICP1 (aka GPIO08 on UnoR3, for example). We assume the
 // detector demodulates the IR signal (e.g. AZ-1838HS optimized for 38Khz).
@@ -10,7 +10,20 @@
 #define NEC_IDLE 1
 #endif
 
-// NEC IR transmission consist of a preamble, 32 data bits, and a postamble.
+// NEC_PROTOCOLS is a bitmask of protocol IDs to decode, default all.
+#ifndef NEC_PROTOCOLS
+#define NEC_PROTOCOLS ((1<<IR_NEC)|(1<<IR_SAMSUNG)|(1<<IR_SONY)|(1<<IR_RC5)|(1<<IR_RC6))
+#endif
+
+// Each protocol is described by a table entry, the decoders for all protocols
+// are run in parallel on each edge. A decoder that sees a pulse it doesn't
+// expect drops out until the end of the frame, so after the header usually
+// only one decoder is doing any work.
+//
+// There are three encodings:
+//
+// DISTANCE: bits are a fixed mark followed by a zero or one space, the frame
+// ends with a fixed mark. E.g. NEC transmission consists of:
 //      Preamble: 9000 uS mark and 4500 uS space
 //      Zero bit: 560 uS mark and 560 uS space
 //      One bit: 560 uS mark and 1690 uS space
@@ -19,148 +32,651 @@
 // repeat code will be sent every 108mS, consisting of:
 //      Preamble: 9000 uS mark and 2250 uS space
 //      Postamle: 560 uS mark
+// Samsung is the same but the preamble mark is 4500 uS, and the whole message
+// is repeated.
+//
+// WIDTH: bits are a zero or one mark followed by a fixed space, the frame ends
+// with a timeout. E.g. Sony SIRC is a 2400 uS preamble mark, then 12, 15 or 20
+// bits of 600 uS space and a 600 uS (zero) or 1200 uS (one) mark.
+//
+// MANCHESTER: each bit is two half bits of opposite polarity. E.g. RC5 is 14
+// 889 uS bits where a one is space then mark, the first half bit is the idle
+// line so there's no preamble. RC6 mode 0 is a 2666 uS mark and 889 uS space
+// preamble then 21 444 uS bits where a one is mark then space, except the
+// fifth (trailer) bit which is twice as long.
 
-// Converts microseconds to TIMER1 ticks
+// Converts microseconds to TIMER1 ticks and back, and ticks to (roughly)
+// milliseconds as a shift
 #if MHZ==16
 #define uS(n) ((n)*2)
+#define ticks2uS(n) ((n)/2)
+#define mS_SHIFT 11
 #elif MHZ==8
 #define uS(n) (n)
+#define ticks2uS(n) (n)
+#define mS_SHIFT 10
 #else
 #error "MHZ not supported"
 #endif
 
-// key queue
+// protocol flags
+#define DISTANCE 0                                      // encoding
+#define WIDTH 1
+#define MANCHESTER 2
+#define MSB 4                                           // first bit is the MSB
+#define MARKONE 8                                       // manchester mark then space is a one
+
+typedef struct
+{
+    uint8_t proto;                                      // protocol ID
+    uint8_t flags;                                      // encoding and bit order
+    uint16_t hmark, hspace;                             // preamble mark and space, or 0
+    uint16_t rspace;                                    // repeat preamble space, or 0
+    uint16_t unit;                                      // fixed mark or space, or manchester half bit
+    uint16_t zero, one;                                 // variable mark or space
+    uint8_t minbits, maxbits;                           // message length
+    uint8_t trailer;                                    // index of double length manchester bit, or 0xff
+    uint8_t hold;                                       // key release timeout in mS
+} protocol;
+
+static const protocol protocols[] PROGMEM =
+{
+#if NEC_PROTOCOLS & (1<<IR_NEC)
+    { IR_NEC, DISTANCE, uS(9000), uS(4500), uS(2250), uS(560), uS(560), uS(1690), 32, 32, 0xff, 120 },
+#endif
+#if NEC_PROTOCOLS & (1<<IR_SAMSUNG)
+    { IR_SAMSUNG, DISTANCE, uS(4500), uS(4500), 0, uS(560), uS(560), uS(1690), 32, 32, 0xff, 120 },
+#endif
+#if NEC_PROTOCOLS & (1<<IR_SONY)
+    { IR_SONY, WIDTH, uS(2400), 0, 0, uS(600), uS(600), uS(1200), 12, 20, 0xff, 60 },
+#endif
+#if NEC_PROTOCOLS & (1<<IR_RC5)
+    { IR_RC5, MANCHESTER|MSB, 0, 0, 0, uS(889), 0, 0, 14, 14, 0xff, 130 },
+#endif
+#if NEC_PROTOCOLS & (1<<IR_RC6)
+    { IR_RC6, MANCHESTER|MSB|MARKONE, uS(2666), uS(889), 0, uS(444), 0, 0, 21, 21, 4, 130 },
+#endif
+};
+
+#define PROTOCOLS (sizeof(protocols)/sizeof(protocol))
+
+#if !(NEC_PROTOCOLS & 0x1f)
+#error "NEC_PROTOCOLS doesn't specify any known protocol"
+#endif
+
+// Longest gap between edges in a message, anything longer ends the message.
+#define GAP uS(12000)
+
+// event queue
 #define KEYS 8
-static volatile uint32_t keys[KEYS];
+static volatile struct
+{
+    int8_t event;                                       // 1 = press, -1 = release
+    irkey key;
+} keys[KEYS];
 static volatile uint8_t head=0, count=0;
 
-// push a key into queue (in interrupt context)
-static inline void push(uint32_t key)
+#ifdef THREAD
+static semaphore keysem;                                // released on each event and waiter timeout
+static bool waiting;                                    // true if a thread is in wait_nec() with a timeout
+static uint32_t waituntil;                              // when its timeout expires
+#endif
+
+// push an event into queue (in interrupt context)
+static inline void push(int8_t event, irkey *key)
 {
     if (count < KEYS)
     {
-        keys[(head+count)%KEYS]=key;
+        uint8_t i=(head+count)%KEYS;
+        keys[i].event=event;
+        keys[i].key=*key;
         count++;
     }
+#ifdef THREAD
+    if (!is_released(&keysem)) release(&keysem);        // wake the waiter, at most once
+#endif
+}
+
+static irkey held;                                      // currently held key
+static bool holding;                                    // true if held is valid
+static uint32_t holduntil;                              // ticks at which held is released
+
+// A message or repeat code was received (in interrupt context). New messages
+// are key presses, repeat codes and repeated messages restart the hold timer.
+// The hold timer is checked by the TIMER1_COMPB interrupt each time the timer
+// wraps.
+static void received(uint8_t proto, uint8_t hold, bool repeat, uint32_t code)
+{
+    uint32_t now = get_ticks();
+    if (repeat)
+    {
+        if (!holding || held.proto != proto) return;    // repeat of nothing
+    }
+    else if (!holding || held.proto != proto || held.code != code)
+    {
+        held.proto = proto;
+        held.code = code;
+        held.time = now;
+        holding = 1;
+        push(1, &held);                                 // key press
+    }
+    held.time = now;                                    // last seen, the release time
+    holduntil = now + hold;
+    TIMSK1 |= 1 << OCIE1B;                              // start checking
+}
+
+// interrupt each time the timer wraps while a key is held or a thread is waiting
+ISR(TIMER1_COMPB_vect)
+{
+    if (holding && expired(holduntil))
+    {
+        holding = 0;
+        push(-1, &held);                                // key release
+    }
+#ifdef THREAD
+    if (waiting && expired(waituntil))
+    {
+        waiting = 0;
+        if (!is_released(&keysem)) release(&keysem);
+    }
+    if (!waiting && !holding)
+#else
+    if (!holding)
+#endif
+        TIMSK1 &= (uint8_t)~(1 << OCIE1B);
+}
+
+// decoder stages
+#define DEAD 0                                          // waiting for end of message
+#define START 1                                         // waiting for end of first mark
+#define HEADER 2                                        // waiting for end of preamble space
+#define DATA 3                                          // receiving bits
+#define REPEATING 4                                     // waiting for end of repeat postamble
+#define DONE 5                                          // message complete, count is its bits
+#define REPEATED 6                                      // repeat code received
+
+// decoder state, per protocol
+static struct decoder
+{
+    uint8_t stage;
+    uint8_t count;                                      // bits, or manchester half bits, received
+    bool first;                                         // manchester first half bit was a mark
+    uint32_t data;                                      // accrued bits
+} decoders[PROTOCOLS];
+
+static bool active;                                     // true if receiving a message
+static uint8_t live;                                    // bit per decoder that isn't DEAD or finished
+
+#ifdef NEC_RAW
+// Raw capture ring, each entry is a pulse width in TIMER1 ticks or, if bit 15
+// is set, a long gap in units of 1<<mS_SHIFT ticks. 0 flags lost entries.
+static volatile uint16_t raw[NEC_RAW];
+static volatile uint8_t rawhead, rawcount;
+static bool capturing;                                  // true if capturing raw pulses
+static bool lost;                                       // true if ring overflowed
+static volatile uint8_t wraps;                          // TIMER1 wraps since last edge, saturates at 255
+
+// Append an entry to the ring, there must be room
+static inline void put(uint16_t e)
+{
+    uint8_t i = rawhead + rawcount;
+    if (i >= NEC_RAW) i -= NEC_RAW;
+    raw[i] = e;
+    rawcount++;
 }
 
-// IR detector state
-static volatile uint32_t state;
+// Store a raw entry (in interrupt context)
+static inline void store(uint16_t e)
+{
+    if (lost)
+    {
+        if (!(e & 0x8000) || rawcount > NEC_RAW-2) return; // resync at a long gap
+        put(0);                                         // flag the loss
+        lost = 0;
+    }
+    if (rawcount < NEC_RAW) put(e); else lost = 1;
+}
+#endif
 
 // Reset IR state machine
 static inline void reset(void)
 {
-    TIMSK1 = 0;                                         // disable timer interrupts
-    state = 0;                                          // reset state
+    TIMSK1 &= 1 << OCIE1B;                              // disable timer interrupts except hold timer
+    active = 0;                                         // wait for first edge
 #if NEC_IDLE
     TCCR1B &= (uint8_t)~(1 << ICES1);                   // detector output normally high, so interrupt on low
 #else
     TCCR1B |= 1 << ICES1;                               // detector output normally low, so interrupt on high
 #endif
-    TIFR1 = 0xff;                                       // clear pending interrupts
-    TIMSK1 = 1 << ICIE1;                                // enable input capture
+    TIFR1 = (1 << ICF1) | (1 << OCF1A);                 // clear pending interrupts
+    TIMSK1 |= 1 << ICIE1;                               // enable input capture
 }
 
-#define REPEAT 0xC0DED00D
+// True if width is within 25% of nominal
+static inline bool near(uint16_t width, uint16_t nominal)
+{
+    return (uint16_t)(width - (nominal - nominal/4)) <= nominal/2;
+}
 
-// interrupt on edge timeout
-ISR(TIMER1_COMPA_vect)
+// Add a bit to decoder data
+static inline void add(struct decoder *d, uint8_t flags, bool bit)
 {
-    // Timeout waiting for next edge. A timeout in state 4 means we received a
-    // repeat code, push as code 0.
-    if (state == 4) push(0);
-    reset();
+    if (flags & MSB)
+        d->data = (d->data << 1) | bit;
+    else
+    {
+        d->data >>= 1;
+        if (bit) d->data |= 0x80000000;
+    }
 }
 
-// interrupt on input edge
-ISR(TIMER1_CAPT_vect)
+// Push a message with specified number of bits
+static void emit(const protocol *p, struct decoder *d, uint8_t bits)
 {
-    static uint32_t bits;                               // accrued bits
-    static uint16_t edge;                               // time of last edge
-    uint16_t width=ICR1-edge;                           // width of last pulse
-    edge=ICR1;                                          // remember new edge
+    uint32_t code = d->data;
+    if (!(pgm_read_byte(&p->flags) & MSB)) code >>= 32 - bits; // LSB first bits are accrued from the top
+    received(pgm_read_byte(&p->proto), pgm_read_byte(&p->hold), 0, code);
+}
+
+// Process a mark or space of given width for decoder i. This is inlined into
+// the capture interrupt, which makes no calls so its prologue stays short.
+// Finished messages are left for the compare interrupt to emit, decode()
+// returns true if there is one.
+static inline __attribute__((always_inline)) bool decode(uint8_t i, bool mark, uint16_t width)
+{
+    const protocol *p = &protocols[i];
+    struct decoder *d = &decoders[i];
+    uint8_t flags = pgm_read_byte(&p->flags);
+    bool bit;
 
-    switch (state)
+    switch (d->stage)
     {
-        case 0:                                         // start of preamble mark
-            OCR1A = edge + uS(9000+900);                // expect it to be 9mS (all times are plus or minus 10%)
-            TIFR1 |= 1 << OCIE1A;                       // clear any pending timeout interrupt
-            TIMSK1 |= 1 << OCF1A;                       // enable timeout interrupt
-            break;
+        case START:                                     // end of first mark
+            d->count = 0;
+            d->data = 0;
+            if (!pgm_read_word(&p->hmark))              // no preamble?
+            {
+                d->stage = DATA;                        // it's a manchester bit whose first half was the idle space
+                d->count = 1;
+                d->first = 0;
+                break;
+            }
+            if (!near(width, pgm_read_word(&p->hmark))) goto dead;
+            d->stage = pgm_read_word(&p->hspace) ? HEADER : DATA;
+            return 0;
 
-        case 1:                                         // end of preamble mark
-            if (width < uS(9000-900)) goto irx;         // too short?
-            OCR1A = edge + uS(4500+450);                // expect space to be 2.25 mS to 4.5mS
-            break;
+        case HEADER:                                    // end of preamble space
+            if (near(width, pgm_read_word(&p->hspace))) d->stage = DATA;
+            else if (pgm_read_word(&p->rspace) && near(width, pgm_read_word(&p->rspace))) d->stage = REPEATING;
+            else goto dead;
+            return 0;
+
+        case REPEATING:                                 // end of repeat postamble
+            if (!near(width, pgm_read_word(&p->unit))) goto dead;
+            d->stage = REPEATED;
+            goto finished;
 
-        case 2:                                         // end of preamble space
-            if (width < uS(2250-225)) goto irx;         // too short?
-            OCR1A = ICR1 + uS(560+56);                  // expect mark to be 560uS
+        case DATA:
             break;
 
-        default:                                        // data bits
-            if (width < uS(560-56)) goto irx;           // too short?
-            if (state & 1)                              // if odd: end of data mark
-                OCR1A = edge + uS(1690+169);            // expect space to be up to 1690 uS
-            else                                        // if even: end of data space
+        default:
+            return 0;
+    }
+
+    switch (flags & 3)
+    {
+        case DISTANCE:
+            if (mark)                                   // fixed mark
             {
-                OCR1A = edge + uS(560+56);              // expect mark to be 560uS
-                bits >>= 1;                             // note another bit
-                if (width>1125) bits |= 0x80000000;     // long space is a 1
+                if (!near(width, pgm_read_word(&p->unit))) goto dead;
+                if (d->count < pgm_read_byte(&p->maxbits)) return 0;
+                goto done;                              // that was the postamble
             }
-            break;
+            if (near(width, pgm_read_word(&p->zero))) bit = 0;
+            else if (near(width, pgm_read_word(&p->one))) bit = 1;
+            else goto dead;
+            add(d, flags, bit);
+            d->count++;
+            return 0;
+
+        case WIDTH:
+            if (!mark)                                  // fixed space
+            {
+                if (!near(width, pgm_read_word(&p->unit))) goto dead;
+                return 0;
+            }
+            if (near(width, pgm_read_word(&p->zero))) bit = 0;
+            else if (near(width, pgm_read_word(&p->one))) bit = 1;
+            else goto dead;
+            add(d, flags, bit);
+            if (++d->count < pgm_read_byte(&p->maxbits)) return 0;
+            goto done;                                  // shorter messages are emitted on timeout
+
+        default:                                        // MANCHESTER
+        {
+            // Consume the pulse one half bit at a time, so the width is
+            // rounded to the nearest number of half bits.
+            uint16_t unit = pgm_read_word(&p->unit);
+            uint8_t trailer = pgm_read_byte(&p->trailer);
+            uint8_t maxhalves = pgm_read_byte(&p->maxbits) * 2;
+            int16_t w = width;
+            uint8_t halves = 0;
+            while (1)
+            {
+                uint16_t half = (d->count/2 == trailer) ? unit*2 : unit;
+                if (w <= (int16_t)(half/2)) break;
+                w -= half;
+                if (++halves > 2) goto dead;            // never more than two half bits the same
+                if (!(d->count & 1)) d->first = mark;   // first half
+                else if (d->first == mark) goto dead;   // second half, must be a transition
+                else add(d, flags, (flags & MARKONE) ? d->first : mark);
+                if (++d->count == maxhalves)
+                {
+                    d->count = maxhalves/2;
+                    goto done;
+                }
+            }
+            if (!halves) goto dead;                     // glitch
+            return 0;
+        }
+    }
 
-        case 67:                                        // end of last pulse
-            if (width < uS(560-56)) goto irx;           // too short?
-            push(bits);                                 // ok push new key
-          irx:
-            reset();                                    // reset state machine
-            return;
+  dead:
+    d->stage = DEAD;
+    live &= (uint8_t)~(1 << i);
+    return 0;
+
+  done:
+    d->stage = DONE;
+  finished:
+    live &= (uint8_t)~(1 << i);
+    return 1;
+}
 
+// interrupt on edge timeout, end of message, or right after the capture
+// interrupt finishes a message
+ISR(TIMER1_COMPA_vect)
+{
+#ifdef NEC_RAW
+    if (capturing)                                      // just count wraps
+    {
+        if (wraps < 255) wraps++;
+        return;
+    }
+#endif
+    for (uint8_t i = 0; i < PROTOCOLS; i++)
+    {
+        const protocol *p = &protocols[i];
+        struct decoder *d = &decoders[i];
+        if (d->stage == DONE)
+        {
+            emit(p, d, d->count);
+            continue;
+        }
+        if (d->stage == REPEATED)
+        {
+            received(pgm_read_byte(&p->proto), pgm_read_byte(&p->hold), 1, 0);
+            continue;
+        }
+        // Messages that end with a space aren't complete until now
+        if (d->stage != DATA) continue;
+        uint8_t flags = pgm_read_byte(&p->flags);
+        if ((flags & 3) == WIDTH)
+        {
+            if (d->count >= pgm_read_byte(&p->minbits)) emit(p, d, d->count);
+        }
+        else if ((flags & 3) == MANCHESTER)
+        {
+            // last bit was mark then space
+            if (d->count == pgm_read_byte(&p->maxbits)*2-1 && d->first)
+            {
+                add(d, flags, (flags & MARKONE) != 0);
+                emit(p, d, pgm_read_byte(&p->maxbits));
+            }
+        }
     }
+    reset();
+}
+
+// interrupt on input edge
+ISR(TIMER1_CAPT_vect)
+{
+    static uint16_t edge;                               // time of last edge
+    uint16_t width=ICR1-edge;                           // width of last pulse
+    edge=ICR1;                                          // remember new edge
+    bool mark=((TCCR1B >> ICES1) & 1) == NEC_IDLE;      // was last pulse a mark?
     TCCR1B ^= (1 << ICES1);                             // toggle edge of interest
-    state++;                                            // advance to next state
+
+#ifdef NEC_RAW
+    if (capturing)
+    {
+        OCR1A = edge;                                   // interrupt each time the timer wraps
+        if (wraps || (width & 0x8000))                  // long gap?
+        {
+            uint32_t w = (((uint32_t)wraps << 16) | width) >> mS_SHIFT;
+            store(0x8000 | (uint16_t)w);
+            wraps = 0;
+        }
+        else store(width);
+        return;
+    }
+#endif
+
+    OCR1A = edge + GAP;                                 // restart timeout
+
+    if (!active)                                        // start of first mark
+    {
+        for (uint8_t i = 0; i < PROTOCOLS; i++) decoders[i].stage = START;
+        live = (1 << PROTOCOLS) - 1;
+        active = 1;
+        TIFR1 = 1 << OCF1A;                             // clear any pending timeout interrupt
+        TIMSK1 |= 1 << OCIE1A;                          // enable timeout interrupt
+        return;
+    }
+
+    // usually only one decoder is live after the header
+    bool finished = 0;
+    uint8_t m = live;
+    for (uint8_t i = 0; m; i++, m >>= 1)
+        if (m & 1) finished |= decode(i, mark, width);
+    if (finished) OCR1A = TCNT1 + 2;                    // let the compare interrupt emit it now
 }
 
-// initialize NEC receiver
+// initialize IR receiver
 void init_nec(void)
 {
     TCNT1 = 0;
     TCCR1A = 0;
     TCCR1B = 2; // clock/8
+    OCR1B = 0;  // hold timer interrupts once per wrap
+    reset();
+}
+
+#ifdef NEC_RAW
+// Enable or disable raw capture. While enabled, keys are not decoded.
+void raw_nec(bool enable)
+{
+    uint8_t sreg = SREG;
+    cli();
     reset();
+    capturing = enable;
+    rawhead = rawcount = 0;
+    lost = 0;
+    wraps = 255;                                        // first entry is a long gap
+    if (enable)
+    {
+        OCR1A = TCNT1;
+        TIMSK1 |= 1 << OCIE1A;
+    }
+    SREG = sreg;
+}
+
+// Remove an entry from the ring, return false if none
+static bool pop(uint16_t *e)
+{
+    uint8_t sreg = SREG;
+    cli();
+    if (!rawcount)
+    {
+        SREG = sreg;
+        return 0;
+    }
+    *e = raw[rawhead];
+    if (++rawhead == NEC_RAW) rawhead = 0;
+    rawcount--;
+    SREG = sreg;
+    return 1;
+}
+
+// Read up to max raw capture entries into *buf and return the number read
+uint8_t read_nec(uint16_t *buf, uint8_t max)
+{
+    uint8_t n;
+    for (n = 0; n < max && pop(buf); n++, buf++)
+        if (*buf && !(*buf & 0x8000)) *buf = ticks2uS(*buf);
+    return n;
+}
+
+// Learn a template from the raw capture, see nec.h
+static bool synced;                                     // true if past the gap at the start of a frame
+static bool restart;                                    // true if template must be cleared
+int8_t learn_nec(irtemplate *t)
+{
+    uint16_t e;
+    while (1)
+    {
+        if (!pop(&e))
+        {
+            // the gap after the last frame isn't captured until the next
+            // edge, so also accept a timer wrap as the end of frame
+            if (synced && !restart && t->count && wraps)
+            {
+                synced = 0;
+                return 1;
+            }
+            return 0;
+        }
+
+        if (!e)                                         // entries were lost
+        {
+            synced = 0;
+            continue;
+        }
+
+        if (e & 0x8000)                                 // long gap, a frame starts after it
+        {
+            bool done = synced && !restart && t->count;
+            synced = 1;
+            restart = 1;
+            if (done) return 1;
+            continue;
+        }
+
+        if (!synced) continue;
+
+        if (restart)
+        {
+            t->count = 0;
+            t->widths = 0;
+            restart = 0;
+        }
+
+        // find a close enough width or add a new one
+        uint16_t us = ticks2uS(e);
+        uint8_t i;
+        for (i = 0; i < t->widths && !near(us, t->width[i]); i++);
+        if (i == t->widths)
+        {
+            if (i == IR_WIDTHS) break;
+            t->width[t->widths++] = us;
+        }
+        if (t->count == IR_PULSES) break;
+        if (t->count & 1) t->pulse[t->count/2] |= i << 4;
+        else t->pulse[t->count/2] = i;
+        t->count++;
+    }
+
+    synced = 0;                                         // can't represent it, try the next frame
+    return -1;
 }
 
+#ifdef COMMAND
+COMMAND(irdump, NULL, "dump raw IR pulses")
+{
+    bool mark = 0;
+    raw_nec(1);
+    pprintf("Press any key to stop\n");
+    while (!readable_serial())
+    {
+        uint16_t buf[8];
+        uint8_t n = read_nec(buf, sizeof(buf)/sizeof(buf[0]));
+        if (!n) sleep_ticks(1);
+        for (uint8_t i = 0; i < n; i++)
+        {
+            if (!buf[i]) pprintf("\n(lost)");         // always followed by a gap
+            else if (buf[i] & 0x8000)
+            {
+                pprintf("\n(gap %u mS)\n", buf[i] & 0x7fff);
+                mark = 1;                               // a frame starts with a mark
+            }
+            else
+            {
+                pprintf("%c%u ", mark ? '+' : '-', buf[i]);
+                mark = !mark;
+            }
+        }
+    }
+    read_serial();
+    raw_nec(0);
+    pprintf("\n");
+}
+#endif
+#endif
+
 // If IR key pressed, set *key and return 1.
 // If IR key released, set *key and return -1.
 // Otherwise return 0.
-// It's possible to get a new key press without a previous key release.
-static uint32_t pressed; // last pressed key
-static uint32_t timeout; // ticks at last event
-int8_t get_nec(uint32_t *key)
+int8_t get_nec(irkey *key)
 {
+    int8_t event = 0;
+    uint8_t sreg = SREG;
+    cli();
     if (count)
     {
-        // there's something in the queue
-        uint8_t sreg = SREG;
-        cli();
-        *key=keys[head++];
-        head %= KEYS;
+        event = keys[head].event;
+        *key = keys[head].key;
+        head = (head+1) % KEYS;
         count--;
-        SREG = sreg;
-        timeout=get_ticks()+110;    // restart timer
-        if (!*key) return 0;        // no event for repeats
-        pressed=*key;
-        return 1;                   // key press
     }
+    SREG = sreg;
+    return event;
+}
 
-    if (pressed && expired(timeout))
+// Wait up to timeout ticks (0 = forever) for a key event, return as get_nec()
+int8_t wait_nec(irkey *key, uint32_t timeout)
+{
+    uint32_t until = get_ticks() + timeout;
+    int8_t event;
+    while (!(event = get_nec(key)))
     {
-        // timeout
-        *key=pressed;
-        pressed = 0;
-        return -1;                  // key release
+        if (timeout && expired(until)) break;
+#ifdef THREAD
+        if (timeout)
+        {
+            uint8_t sreg = SREG;
+            cli();
+            waiting = 1;                                // the hold timer interrupt checks the timeout
+            waituntil = until;
+            TIMSK1 |= 1 << OCIE1B;
+            SREG = sreg;
+        }
+        suspend(&keysem);                               // until an event or timeout
+#else
+        sleep_cpu();                                    // until the next interrupt
+#endif
     }
-
-    return 0;
+#ifdef THREAD
+    waiting = 0;
+#endif
+    return event;
 }
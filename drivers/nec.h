@@ -1,12 +1,68 @@
-// Receive NEC IR
+// Receive IR remote control codes
 
-// Init NEC IR receiver
+// Protocol IDs. By default all protocols are decoded in parallel, to decode
+// fewer define NEC_PROTOCOLS as a bitmask of (1 << id) in main.h.
+#define IR_NEC      0
+#define IR_SAMSUNG  1
+#define IR_SONY     2
+#define IR_RC5      3
+#define IR_RC6      4
+
+// A received key
+typedef struct
+{
+    uint8_t proto;      // protocol ID
+    uint32_t code;      // received bits, first bit is the LSB for NEC, SAMSUNG, and SONY, else the MSB
+    uint32_t time;      // ticks when the key was first received (press) or last received (release)
+} irkey;
+
+// Init IR receiver
 void init_nec(void);
 
 // If IR key pressed, set *key and return 1. If IR key released, set *key and
 // return -1.  Otherwise return 0.
 // It's possible to get a new key press without a previous key release.
-int8_t get_nec(uint32_t *key);
+int8_t get_nec(irkey *key);
+
+// Wait up to timeout ticks for a key event, or forever if timeout is 0. Return
+// as get_nec(), i.e. 0 on timeout. Threads suspend until an event arrives,
+// only one thread should wait at a time. Timeouts have a resolution of one
+// TIMER1 wrap, about 33 mS.
+int8_t wait_nec(irkey *key, uint32_t timeout);
+
+#ifdef NEC_RAW
+// Raw capture, for remotes that aren't decoded. Define NEC_RAW in main.h as
+// the number of entries in the capture ring (up to 255, two bytes each).
+
+// Enable or disable raw capture, the ring is emptied. While enabled, keys are
+// not decoded.
+void raw_nec(bool enable);
+
+// Read up to max captured entries into *buf and return the number read.
+// Entries alternate between mark and space widths in uS, starting with the
+// space before the first mark. An entry with bit 15 set is a long space in
+// units of 1.024 mS. An entry of 0 means following entries were lost because
+// the ring was full.
+uint8_t read_nec(uint16_t *buf, uint8_t max);
+
+// A learned frame, the pulses alternate between mark and space starting with
+// a mark, each pulse is an index into the list of distinct widths.
+#define IR_WIDTHS 8
+#define IR_PULSES 128
+typedef struct
+{
+    uint8_t widths;                     // number of distinct widths
+    uint8_t count;                      // number of pulses
+    uint16_t width[IR_WIDTHS];          // distinct widths in uS
+    uint8_t pulse[IR_PULSES/2];         // width index of each pulse, two per byte with even pulses in the low nibble
+} irtemplate;
+
+// Consume raw capture entries and fold the next complete frame into *t.
+// Return 1 when a frame has been learned, 0 if the frame isn't complete yet,
+// or -1 if the frame can't be represented (too many pulses or widths), in
+// which case the next frame is tried. Raw capture must be enabled.
+int8_t learn_nec(irtemplate *t);
+#endif
 
 // Extract vendor ID, key code or check byte from a NEC key code. In theory the
 // check byte is the binary inverse of the key code, but some vendors e.g. TiVo
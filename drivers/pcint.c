@@ -0,0 +1,50 @@
+// Pin change interrupt dispatcher. The chip has one pin change interrupt per
+// port, this driver owns all of them and calls the handler attached to each
+// pin that changed state. Port index 0, 1, 2 is port B, C, D.
+
+static void (* volatile handlers[3][8])(uint8_t);   // handler per port and bit
+static volatile uint8_t last[3];                    // last seen state of each port
+
+// Call handlers for the pins that changed since last time
+static inline void dispatch(uint8_t port, uint8_t pins, uint8_t mask)
+{
+    uint8_t changed = (pins ^ last[port]) & mask;
+    last[port] = pins;
+    for (uint8_t n=0, bit=1; changed; n++, bit<<=1)
+    {
+        if (changed & bit)
+        {
+            handlers[port][n](pins & bit);
+            changed &= (uint8_t)~bit;
+        }
+    }
+}
+
+ISR(PCINT0_vect) { dispatch(0, PINB, PCMSK0); }
+ISR(PCINT1_vect) { dispatch(1, PINC, PCMSK1); }
+ISR(PCINT2_vect) { dispatch(2, PIND, PCMSK2); }
+
+// Attach handler to gpio pin change, or detach if handler is NULL
+void attach_pcint(gpio *g, void (*handler)(uint8_t state))
+{
+    uint8_t port = (g->pin == &PINB) ? 0 : (g->pin == &PINC) ? 1 : 2;
+    volatile uint8_t *mask = (port == 0) ? &PCMSK0 : (port == 1) ? &PCMSK1 : &PCMSK2;
+    uint8_t n = 0;
+    while (!(g->bit & (1 << n))) n++;               // bit number
+
+    uint8_t sreg = SREG;
+    cli();
+    handlers[port][n] = handler;
+    if (handler)
+    {
+        last[port] = (last[port] & (uint8_t)~g->bit) | get_gpio(g); // start from current state
+        *mask |= g->bit;                            // enable pin
+        PCICR |= 1 << port;                         // and port
+    }
+    else
+    {
+        *mask &= (uint8_t)~g->bit;                  // disable pin
+        if (!*mask) PCICR &= (uint8_t)~(1 << port); // and port if no others
+    }
+    SREG = sreg;
+}
@@ -0,0 +1,6 @@
+// Pin change interrupt dispatcher
+
+// Attach a handler to the specified gpio's pin change interrupt, or detach if
+// handler is NULL. The handler is called in interrupt context whenever the
+// pin changes state, with the new pin state (zero or non-zero).
+void attach_pcint(gpio *g, void (*handler)(uint8_t state));
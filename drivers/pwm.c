@@ -6,16 +6,21 @@
 #error "Must define USE_PWM_TIMER0 or USE_PWM_TIMER1 (or both)"
 #endif
 
+// Batched updates, see begin_pwm()
+static bool staging;                                // true if updates are staged
+static volatile bool committing;                    // true if the overflow ISR must apply them
+static void apply(void);
+
 #ifdef USE_PWM_TIMER0
 // Configure PWM0 width 0 to 255, or disable output completely < 0.
-void set_pwm0(int16_t width)
+static void pwm0(int16_t width)
 {
     if (width < 0)
     {
         CLR_GPIO(PWM0);                             // low
         IN_GPIO(PWM0);                              // input
         TCCR0A &= 0x3F;                             // disable COM0A
-        if (!IS_OUT_GPIO(PWM1)) TCCR0B=0;           // and clock if pwm1 is also disabled
+        if (!IS_OUT_GPIO(PWM1) && !(TIMSK0 & (1 << TOIE0))) TCCR0B=0; // and clock if pwm1 is also disabled and nothing is fading
         return;
     }
 
@@ -38,14 +43,14 @@ void set_pwm0(int16_t width)
 }
 
 // Configure PWM1 width 0 to 255, or disable output completely < 0.
-void set_pwm1(int16_t width)
+static void pwm1(int16_t width)
 {
     if (width < 0)
     {
         CLR_GPIO(PWM1);                             // low
         IN_GPIO(PWM1);                              // input
         TCCR0A &= 0xCF;                             // disable COM0B
-        if (!IS_OUT_GPIO(PWM0)) TCCR0B=0;           // turn off clock if pwm0 is also disabled
+        if (!IS_OUT_GPIO(PWM0) && !(TIMSK0 & (1 << TOIE0))) TCCR0B=0; // turn off clock if pwm0 is also disabled and nothing is fading
         return;
     }
 
@@ -69,125 +74,583 @@ void set_pwm1(int16_t width)
 #endif
 
 #ifdef USE_PWM_TIMER1
+// TIMER1 runs in fast PWM mode 14 or phase and frequency correct mode 8, both
+// with TOP=ICR1
+#define WGMA(phase) ((phase) ? 0x00 : 0x02)         // TCCR1A WGM bits
+#define WGMB(phase) ((phase) ? 0x10 : 0x18)         // TCCR1B WGM bits
+
 // remember current frequency
 static uint16_t top=255;    // initially the same as timer 0
 static uint8_t prescale=2;
-static uint8_t width2;      // current pwm2 pulse width 0-255
-static uint8_t width3;      // current pwm3 pulse width 0-255
-
-// Set timer1 frequency, 1 to 62500Hz. Returns the actual configured frequency
-// which due to rounding errors will usually be somewhat higher than the
-// requested frequency. If frequency==0 then the clock is set to match timer0.
-// Note Hz=F_CPU/(div*(ICR1+1)) and ICR1=(F_CPU/(Hz*div))-1. Existing PWM
-// ratios are maintained.
+static bool phase;          // true if phase and frequency correct mode
+static uint32_t scale=256;  // top*256/255, converts 8-bit widths to OCR values
+static uint16_t ocr2;       // current pwm2 pulse width 0-top
+static uint16_t ocr3;       // current pwm3 pulse width 0-top
+static volatile uint8_t update; // frequency update steps remaining in the ISR
+
+// Frequency changes are applied by the overflow interrupt at the start of a
+// period. OCR1A/B are double buffered but ICR1 isn't, so the first interrupt
+// writes the new OCR values, which take effect at the next period, and sets
+// TOP to be long enough for both the old and new values. The second interrupt
+// sets the new TOP and prescaler. So the outputs never see a period where OCR
+// is past TOP.
+ISR(TIMER1_OVF_vect)
+{
+    if (committing)
+    {
+        apply();
+        committing = 0;
+        if (!update) TIMSK1 &= (uint8_t)~(1 << TOIE1);
+    }
+    else if (update == 2)
+    {
+        uint16_t t = top;
+        if (OCR1A > t) t = OCR1A;
+        if (OCR1B > t) t = OCR1B;
+        ICR1 = t;
+        OCR1A = ocr2;
+        OCR1B = ocr3;
+        update = 1;
+    }
+    else
+    {
+        ICR1 = top;
+        TCCR1B = WGMB(phase)|prescale;
+        TIMSK1 &= (uint8_t)~(1 << TOIE1);
+        update = 0;
+    }
+}
+
+// Set timer1 frequency, 1 to 62500Hz (or half that in phase correct mode).
+// Returns the actual configured frequency which due to rounding errors will
+// usually be somewhat higher than the requested frequency. If frequency==0
+// then the clock is set to match timer0.
+// Note for fast PWM Hz=F_CPU/(div*(ICR1+1)) and ICR1=(F_CPU/(Hz*div))-1, for
+// phase correct Hz=F_CPU/(2*div*ICR1). Existing PWM ratios are maintained.
+static bool stagedfreq;     // true if a frequency change is staged
+static uint16_t stagedtop;
+static uint8_t stagedprescale;
+static uint32_t stagedscale;
+
+// Change frequency with interrupts disabled, rescaling widths so outputs that
+// are fully on or off stay that way
+static void frequency(uint16_t t, uint8_t p, uint32_t s)
+{
+    uint16_t oldtop = top;
+    top = t;
+    prescale = p;
+    scale = s;
+    if (ocr2) ocr2 = (ocr2 >= oldtop) ? top : ((uint32_t)ocr2*top)/oldtop;
+    if (ocr3) ocr3 = (ocr3 >= oldtop) ? top : ((uint32_t)ocr3*top)/oldtop;
+}
+
 uint16_t set_timer1_freq(uint16_t hz)
 {
     uint16_t div[] = { 0, 1, 8, 64, 256, 1024 }; // map prescaler index to divider value
+    uint16_t newtop;
+    uint8_t newprescale;
 
-    if (!hz) top = 255, prescale = 2; // restore default
+    if (!hz) newtop = 255, newprescale = 2; // restore default
     else
     {
         // find the highest prescaler which can provide requested frequency
         int32_t t;
-        for (prescale = 5; prescale; prescale--)
+        for (newprescale = 5; newprescale; newprescale--)
         {
-            t=((MHZ*1000000)/((uint32_t)hz*div[prescale]))-1;
+            t=((MHZ*1000000)/((uint32_t)hz*div[newprescale]<<phase))-!phase;
             if (t >= 255) break;
         }
-        if (!prescale) t=255, prescale=1; // too high
-        top=t;
+        if (!newprescale) t=255, newprescale=1; // too high
+        newtop=t;
     }
+    uint32_t newscale = ((uint32_t)newtop << 8) / 255;
 
-    // update pwms if currently running
-    if (TCCR1B)
+    uint8_t sreg = SREG;
+    cli();
+    if (staging)
     {
-        TCCR1B=0;
-        TCNT1=0;
-        ICR1 = top;
-        if (width2) OCR1A = ((uint32_t)top*width2)/255;
-        if (width3) OCR1B = ((uint32_t)top*width3)/255;
-        TCCR1B = 0x18|prescale; // CTC IRC1 with prescale
+        // apply at commit
+        stagedfreq = 1;
+        stagedtop = newtop;
+        stagedprescale = newprescale;
+        stagedscale = newscale;
     }
+    else
+    {
+        frequency(newtop, newprescale, newscale);
+        if (TCCR1B & 7)
+        {
+            // running, let the ISR do it
+            update = 2;
+            TIFR1 = 1 << TOV1;
+            TIMSK1 |= 1 << TOIE1;
+        }
+        else
+        {
+            ICR1 = top;
+            OCR1A = ocr2;
+            OCR1B = ocr3;
+        }
+    }
+    SREG = sreg;
 
     // return the actual frequency
-    return (MHZ*1000000)/((uint32_t)div[prescale]*(top+1));
+    return (MHZ*1000000)/((uint32_t)div[newprescale]*(newtop+!phase)<<phase);
 }
 
-// Configure PWM2 width 0 to 255, or disable output completely < 0.
-// Set PWM2 pulse width as (255/width)*100%
-void set_pwm2(int16_t width)
+// Return the TOP value for the current timer1 frequency, i.e. the 100% width
+// for set_pwm2_16() and set_pwm3_16().
+uint16_t get_timer1_top(void)
 {
-    width2 = 0;
-    if (width < 0)
+    return top;
+}
+
+// Select fast PWM (false) or phase and frequency correct PWM (true) for
+// timer1. Phase correct PWM has half the frequency for the same TOP, the
+// frequency is recalculated. Running outputs restart.
+uint16_t set_timer1_phase(bool enable, uint16_t hz)
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t running = TCCR1B & 7;
+    TCCR1B = 0;
+    TIMSK1 &= (uint8_t)~(1 << TOIE1);
+    update = 0;
+    phase = enable;
+    TCCR1A = (TCCR1A & 0xF0) | WGMA(phase);
+    SREG = sreg;
+    hz = set_timer1_freq(hz);
+    if (running)
     {
-        CLR_GPIO(PWM2);                             // low
-        IN_GPIO(PWM2);                              // input
-        TCCR1A &= 0x3F;                             // disable COM1A
-        if (!IS_OUT_GPIO(PWM3)) TCCR1B=0;           // turn off clock if pwm3 is also disabled
-        return;
+        TCNT1 = 0;
+        TCCR1B = WGMB(phase)|prescale;
     }
+    return hz;
+}
+
+// Start timer1 if it isn't already running
+static void start1(void)
+{
+    if (TCCR1B & 7) return;
+    ICR1 = top;
+    TCCR1A = (TCCR1A & 0xF0) | WGMA(phase);
+    TCCR1B = WGMB(phase)|prescale;
+}
 
+// Set PWM2 pulse width 0 to get_timer1_top()
+static void pwm2_16(uint16_t width)
+{
     if (width == 0)
     {
         CLR_GPIO(PWM2);                             // low
         TCCR1A &= 0x3F;                             // disable COM1A
-    } else if (width >= 255)
+    } else if (width >= top)
     {
+        width = top;
         SET_GPIO(PWM2);                             // high
         TCCR1A &= 0x3F;                             // disable COM1A
     } else
     {
-        width2 = width;                             // remember pwm2 width
-        ICR1 = top;
-        OCR1A = ((uint32_t)top*width2)/255;         // set pulse width as a fraction of top
+        OCR1A = width;                              // set pulse width
         CLR_GPIO(PWM2);                             // low
-        TCCR1A |= 0x82;                             // COM1A non-inverting
-        TCCR1B = 0x18|prescale;                     // CTC ICR1 with prescale
+        TCCR1A |= 0x80;                             // COM1A non-inverting
+        start1();
     }
+    ocr2 = width;                                   // remember pwm2 width
     OUT_GPIO(PWM2);                                 // output
 }
 
+// Set PWM3 pulse width 0 to get_timer1_top()
+static void pwm3_16(uint16_t width)
+{
+    if (width == 0)
+    {
+        CLR_GPIO(PWM3);                             // low
+        TCCR1A &= 0xCF;                             // disable COM1B
+    } else if (width >= top)
+    {
+        width = top;
+        SET_GPIO(PWM3);                             // high
+        TCCR1A &= 0xCF;                             // disable COM1B
+    } else
+    {
+        OCR1B = width;                              // set pulse width
+        CLR_GPIO(PWM3);                             // low
+        TCCR1A |= 0x20;                             // COM1B non-inverting
+        start1();
+    }
+    ocr3 = width;                                   // remember pwm3 width
+    OUT_GPIO(PWM3);                                 // output
+}
+
+// Configure PWM2 width 0 to 255, or disable output completely < 0.
+// Set PWM2 pulse width as (255/width)*100%
+static void pwm2(int16_t width)
+{
+    if (width < 0)
+    {
+        ocr2 = 0;
+        CLR_GPIO(PWM2);                             // low
+        IN_GPIO(PWM2);                              // input
+        TCCR1A &= 0x3F;                             // disable COM1A
+        if (!IS_OUT_GPIO(PWM3)) TCCR1B=0;           // turn off clock if pwm3 is also disabled
+        return;
+    }
+    pwm2_16((width >= 255) ? top : ((uint32_t)width*scale) >> 8);
+}
+
 // Configure PWM3 width 0 to 255, or disable output completely < 0.
-void set_pwm3(int16_t width)
+static void pwm3(int16_t width)
 {
-    width3 = 0;
     if (width < 0)
     {
+        ocr3 = 0;
         CLR_GPIO(PWM3);                             // low
         IN_GPIO(PWM3);                              // input
         TCCR1A &= 0xCF;                             // disable COM1B
         if (!IS_OUT_GPIO(PWM2)) TCCR1B=0;           // turn off clock if pwm2 is also disabled
         return;
     }
+    pwm3_16((width >= 255) ? top : ((uint32_t)width*scale) >> 8);
+}
+#endif
 
-    if (width == 0)
+
+#ifdef USE_PWM_TIMER0
+// Fades are advanced by the TIMER0 overflow interrupt, every 8 overflows.
+// Timer 0 always runs at clock/8 with 256 counts so that's 2048*8 clocks, i.e.
+// 1.024 mS at 16 MHz.
+#define STEP_CLOCKS (2048UL*8)
+
+// Perceived brightness to PWM width, gamma 2.2
+static const uint8_t perceived[256] PROGMEM =
+{
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+      1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+      3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+      6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+     12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+     20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+     30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+     42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+     56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+     73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+     91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+    113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+    137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+    163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+    192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+    223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255,
+};
+
+static struct
+{
+    uint16_t level;         // current level, 8.8 fixed point
+    int16_t step;           // added to level each step
+    uint16_t steps;         // steps remaining, 0 if not fading
+    uint8_t target;         // final level
+    uint8_t curve;          // PWM_LINEAR or PWM_GAMMA
+    bool wide;              // level is stale, last set by a 16-bit width
+} fades[4];
+
+#ifdef THREAD
+static semaphore faded[4];  // released when each fade completes
+#endif
+
+// Set output width from ISR
+static void output(uint8_t pwm, int16_t width)
+{
+    switch (pwm)
     {
-        CLR_GPIO(PWM3);                             // low
-        TCCR1A &= 0xCF;                             // disable COM1B
-    } else if (width >= 255)
+        case 0: pwm0(width); break;
+        case 1: pwm1(width); break;
+#ifdef USE_PWM_TIMER1
+        case 2: pwm2(width); break;
+        case 3: pwm3(width); break;
+#endif
+    }
+}
+
+ISR(TIMER0_OVF_vect)
+{
+    static uint8_t prescale;
+    if (committing)
     {
-        SET_GPIO(PWM3);                             // high
-        TCCR1A &= 0xCF;                             // disable COM1B
-    } else
+        apply();
+        committing = 0;
+    }
+    if (++prescale & 7) return;
+
+    bool fading = 0;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        if (!fades[i].steps) continue;
+        if (--fades[i].steps)
+        {
+            fades[i].level += fades[i].step;
+            fading = 1;
+        }
+        else
+        {
+            fades[i].level = (uint16_t)fades[i].target << 8;
+#ifdef THREAD
+            release(&faded[i]);
+#endif
+        }
+        uint8_t l = fades[i].level >> 8;
+        output(i, (fades[i].curve == PWM_GAMMA) ? pgm_read_byte(&perceived[l]) : l);
+    }
+    if (!fading) TIMSK0 &= (uint8_t)~(1 << TOIE0);
+}
+
+// Fade PWM output from its current level to target over ms milliseconds. With
+// PWM_GAMMA, levels are perceived brightness. The output is updated about
+// once per millisecond by the ISR.
+void fade_pwm(uint8_t pwm, uint8_t target, uint16_t ms, uint8_t curve)
+{
+    if (pwm > 3) return;
+#ifdef USE_PWM_TIMER1
+    if (fades[pwm].wide)                            // derive level from the output width
     {
-        width3 = width;                             // remember pwm3 width
+        uint16_t width = (pwm == 2) ? ocr2 : ocr3;
+        fades[pwm].level = (width >= top) ? 0xff00 : (uint16_t)(((uint32_t)width << 8) / scale) << 8;
+        fades[pwm].wide = 0;
+    }
+#endif
+    uint16_t steps = ((uint32_t)ms*MHZ*1000 + STEP_CLOCKS/2) / STEP_CLOCKS;
+    if (!steps) steps = 1;
+    int16_t step = 0;
+    if (steps > 1) step = (((int32_t)target << 8) - (fades[pwm].level & 0xff00)) / steps;
+
+    uint8_t sreg = SREG;
+    cli();
+    fades[pwm].level &= 0xff00;
+    fades[pwm].step = step;
+    fades[pwm].target = target;
+    fades[pwm].curve = curve;
+    fades[pwm].steps = steps;
+    if (!TCCR0B) TCCR0B = 2;                        // timer 0 may not be running yet
+    TIMSK0 |= 1 << TOIE0;
+    SREG = sreg;
+}
+
+// Return fade steps remaining, the ISR changes them
+static uint16_t remaining(uint8_t pwm)
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t steps = *(volatile uint16_t *)&fades[pwm].steps;
+    SREG = sreg;
+    return steps;
+}
+
+// Return true if PWM output is fading
+bool fading_pwm(uint8_t pwm)
+{
+    return (pwm <= 3) && remaining(pwm);
+}
+
+// Wait for PWM output to finish fading
+void wait_pwm(uint8_t pwm)
+{
+    if (pwm > 3) return;
+    sei();
+#ifdef THREAD
+    while (remaining(pwm)) suspend(&faded[pwm]);
+#else
+    while (remaining(pwm));
+#endif
+}
+
+// Stop fading and remember the new level, interrupts must be disabled
+static void stop(uint8_t pwm, int16_t level)
+{
+    fades[pwm].steps = 0;
+    fades[pwm].level = (level < 0) ? 0 : (level > 255) ? 0xff00 : level << 8;
+    fades[pwm].wide = 0;
+}
+
+#ifdef USE_PWM_TIMER1
+// Stop fading after a 16-bit width is set. Converting the width to a level
+// needs a 32-bit divide, so fade_pwm() does that only if a fade starts from
+// it. Interrupts must be disabled.
+static void stop16(uint8_t pwm)
+{
+    fades[pwm].steps = 0;
+    fades[pwm].wide = 1;
+}
+#endif
+#else
+#define stop(pwm, level)
+#define stop16(pwm)
+#endif
+
+// Batched updates. Staged widths are applied by apply(), a frequency change
+// is staged by set_timer1_freq().
+static struct
+{
+    uint8_t kind;           // 0 = nothing staged, 8 or 16 bit width
+    int32_t width;
+} staged[4];
+
+// Stage a width if batching and return true, interrupts must be disabled
+static bool stage(uint8_t pwm, uint8_t kind, int32_t width)
+{
+    if (!staging) return 0;
+    staged[pwm].kind = kind;
+    staged[pwm].width = width;
+    return 1;
+}
+
+// Apply staged updates with interrupts disabled, normally from the overflow
+// interrupt just after the start of a period. Both timers are halted while
+// registers are written, then the counters are set to TOP so they wrap
+// together on the next tick, which is also when the double buffered OCR
+// registers are loaded. So all outputs change in the same period, and the
+// timers are synchronized.
+static void apply(void)
+{
+    GTCCR = (1 << TSM) | (1 << PSRSYNC);            // halt timer 0 and 1
+#ifdef USE_PWM_TIMER1
+    if (stagedfreq)
+    {
+        frequency(stagedtop, stagedprescale, stagedscale);
         ICR1 = top;
-        OCR1B = ((uint32_t)top*width3)/255;         // set pulse width
-        CLR_GPIO(PWM3);                             // low
-        TCCR1A |= 0x22;                             // COM1B non-inverting mode
-        TCCR1B = 0x18|prescale;                     // CTC ICR1 with prescale
+        OCR1A = ocr2;
+        OCR1B = ocr3;
+        if (TCCR1B & 7) TCCR1B = WGMB(phase)|prescale;
+        update = 0;                                 // cancel unbatched change
+        stagedfreq = 0;
     }
-    OUT_GPIO(PWM3);                                 // output
+#endif
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        int32_t w = staged[i].width;
+        switch (staged[i].kind ? i : 4)
+        {
+#ifdef USE_PWM_TIMER0
+            case 0: pwm0(w); break;
+            case 1: pwm1(w); break;
+#endif
+#ifdef USE_PWM_TIMER1
+            case 2: if (staged[i].kind == 16) pwm2_16(w); else pwm2(w); break;
+            case 3: if (staged[i].kind == 16) pwm3_16(w); else pwm3(w); break;
+#endif
+        }
+        staged[i].kind = 0;
+    }
+#ifdef USE_PWM_TIMER1
+    // in phase correct mode OCR is loaded at BOTTOM, counting can't be
+    // restarted there, so the change is a period later
+    if ((TCCR1B & 7) && !phase) TCNT1 = top;
+#endif
+#ifdef USE_PWM_TIMER0
+    if (TCCR0B) TCNT0 = 255;
+#endif
+    GTCCR = 0;                                      // let timers run
+}
+
+// Start staging updates
+void begin_pwm(void)
+{
+    staging = 1;
 }
+
+// Apply staged updates at the next timer overflow, wait until done
+void commit_pwm(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    staging = 0;
+#ifdef USE_PWM_TIMER1
+    if (TCCR1B & 7)
+    {
+        committing = 1;
+        TIFR1 = 1 << TOV1;
+        TIMSK1 |= 1 << TOIE1;
+    }
+    else
+#endif
+#ifdef USE_PWM_TIMER0
+    if (TCCR0B)
+    {
+        committing = 1;
+        TIFR0 = 1 << TOV0;
+        TIMSK0 |= 1 << TOIE0;
+    }
+    else
+#endif
+        apply();                                    // no timer running, do it now
+    SREG = sreg;
+    sei();
+#ifdef THREAD
+    while (committing) yield();
+#else
+    while (committing);
 #endif
+}
 
-#if defined(USE_PWM_TIMER0) && defined(USE_PWM_TIMER1)
 // Sync timer0 and timer1 so PWM outputs go high at the same time.
 void sync_pwm(void)
 {
-    GTCCR=0x81;                                     // Set TSM and PSRSYNC to halt timer 0 and 1
-    TCNT0=0;
-    TCNT1=0;
-    GTCCR=0;                                        // let timers run
+    commit_pwm();
+}
+
+// Public width setters stop any fade in progress, and are staged if batching
+#ifdef USE_PWM_TIMER0
+void set_pwm0(int16_t width)
+{
+    uint8_t sreg = SREG;
+    cli();
+    stop(0, width);
+    if (!stage(0, 8, width)) pwm0(width);
+    SREG = sreg;
+}
+
+void set_pwm1(int16_t width)
+{
+    uint8_t sreg = SREG;
+    cli();
+    stop(1, width);
+    if (!stage(1, 8, width)) pwm1(width);
+    SREG = sreg;
+}
+#endif
+
+#ifdef USE_PWM_TIMER1
+void set_pwm2(int16_t width)
+{
+    uint8_t sreg = SREG;
+    cli();
+    stop(2, width);
+    if (!stage(2, 8, width)) pwm2(width);
+    SREG = sreg;
+}
+
+void set_pwm3(int16_t width)
+{
+    uint8_t sreg = SREG;
+    cli();
+    stop(3, width);
+    if (!stage(3, 8, width)) pwm3(width);
+    SREG = sreg;
+}
+
+void set_pwm2_16(uint16_t width)
+{
+    uint8_t sreg = SREG;
+    cli();
+    stop16(2);
+    if (!stage(2, 16, width)) pwm2_16(width);
+    SREG = sreg;
+}
+
+void set_pwm3_16(uint16_t width)
+{
+    uint8_t sreg = SREG;
+    cli();
+    stop16(3);
+    if (!stage(3, 16, width)) pwm3_16(width);
+    SREG = sreg;
 }
 #endif
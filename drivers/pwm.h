@@ -3,5 +3,42 @@ void set_pwm0(int16_t width);
 void set_pwm1(int16_t width);
 void set_pwm2(int16_t width);
 void set_pwm3(int16_t width);
-void sync_pwm(void);
 uint16_t set_timer1_freq(uint16_t Hz);
+
+// Timer 1 has 16-bit resolution, these set PWM2 and PWM3 widths from 0 to
+// get_timer1_top() (which depends on the frequency) without scaling.
+void set_pwm2_16(uint16_t width);
+void set_pwm3_16(uint16_t width);
+uint16_t get_timer1_top(void);
+
+// Select fast (false) or phase and frequency correct (true) PWM for timer 1
+// and set the frequency as set_timer1_freq(). Phase correct outputs are
+// centered in the period, which suits motor drivers.
+uint16_t set_timer1_phase(bool enable, uint16_t Hz);
+
+// Batch updates. After begin_pwm(), width and frequency changes are staged
+// rather than applied. commit_pwm() then applies them all in one overflow
+// interrupt, so every output changes in the same period, and restarts the
+// timers together. Waits for the interrupt, typically one PWM period. In phase
+// correct mode the timer 1 outputs change a period later than timer 0's.
+void begin_pwm(void);
+void commit_pwm(void);
+
+// Sync timer 0 and 1 so their periods start together, same as commit_pwm()
+// with nothing staged.
+void sync_pwm(void);
+
+#ifdef USE_PWM_TIMER0
+// Fade PWM output 0 to 3 from its current level to target (0 to 255) over ms
+// milliseconds, using timer 0's overflow interrupt, so no thread is involved.
+// Setting the width directly stops the fade.
+#define PWM_LINEAR 0        // levels are PWM widths
+#define PWM_GAMMA 1         // levels are perceived brightness
+void fade_pwm(uint8_t pwm, uint8_t target, uint16_t ms, uint8_t curve);
+
+// Return true if PWM output is fading
+bool fading_pwm(uint8_t pwm);
+
+// Wait until PWM output has finished fading
+void wait_pwm(uint8_t pwm);
+#endif
@@ -0,0 +1,278 @@
+// Servo pulses via TIMER1 in CTC mode with TOP=ICR1 at clock/8. The compare B
+// interrupt just before TOP starts the frame and the compare A interrupt
+// walks a schedule of edges sorted by width, as in softpwm. Both interrupts
+// are set LEAD ticks early and spin on TCNT1 so the edges are exact.
+// Schedules are double buffered and only built by the compare B interrupt,
+// after the frame has started, which is also where moves are interpolated.
+
+#ifndef SERVO_PINS
+#error "Must define SERVO_PINS"
+#endif
+
+#ifdef USE_PWM_TIMER1
+#error "servo conflicts with USE_PWM_TIMER1"
+#endif
+
+#ifndef SERVO_FRAME
+#define SERVO_FRAME 20000
+#endif
+
+#ifndef SERVO_MIN
+#define SERVO_MIN 500
+#endif
+
+#ifndef SERVO_MAX
+#define SERVO_MAX 2500
+#endif
+
+// Convert uS to timer ticks at clock/8
+#define TICKS(us) (uint16_t)((uint32_t)(us)*MHZ/8)
+
+#define TOP (TICKS(SERVO_FRAME)-1)
+#if SERVO_FRAME > 32000
+#error "SERVO_FRAME is too long"
+#endif
+#if SERVO_MIN < 100 || SERVO_MAX >= SERVO_FRAME/2
+#error "Invalid SERVO_MIN or SERVO_MAX"
+#endif
+
+// Interrupts are requested this many ticks early to cover their latency
+#define LEAD TICKS(10)
+
+static const gpio pins[] PROGMEM = { SERVO_PINS };
+#define SERVOS (sizeof(pins)/sizeof(gpio))
+
+// Outputs are grouped by port, 0=B, 1=C, 2=D
+static uint8_t port[SERVOS], bit[SERVOS];
+static uint8_t order[SERVOS];                       // servos sorted by width
+
+static struct
+{
+    uint16_t width;                                 // current width in ticks, 0 = off
+    uint16_t target;                                // width at end of move
+    uint32_t position;                              // width during move, 24.8 fixed point
+    int32_t step;                                   // added to position every frame
+    uint16_t frames;                                // frames until the move ends, 0 if not moving
+} servos[SERVOS];
+
+#ifdef THREAD
+static semaphore moved[SERVOS];                     // released when each move completes
+#endif
+
+typedef struct
+{
+    uint8_t on[3];                                  // pins to set at start of frame
+    struct
+    {
+        uint16_t value;                             // clear at this count, 0xFFFF ends the list
+        uint8_t off[3];                             // pins to clear
+    } edge[SERVOS+1];
+} schedule;
+
+static schedule schedules[2];
+static uint8_t active;                              // schedule in use by the ISR
+static bool pending;                                // true if the spare schedule is ready
+static bool changed;                                // true if a width was set
+static uint8_t next;                                // next edge in the active schedule
+
+// Advance moves by one frame, return true if any width changed
+static bool move(void)
+{
+    bool any = 0;
+    for (uint8_t c = 0; c < SERVOS; c++)
+    {
+        if (!servos[c].frames) continue;
+        any = 1;
+        if (--servos[c].frames)
+        {
+            servos[c].position += servos[c].step;
+            servos[c].width = servos[c].position >> 8;
+        }
+        else
+        {
+            servos[c].width = servos[c].target;
+#ifdef THREAD
+            release(&moved[c]);
+#endif
+        }
+    }
+    return any;
+}
+
+// Build the spare schedule from current widths. Interrupt context.
+static void build(void)
+{
+    // insertion sort, the order rarely changes so this is usually one pass
+    for (uint8_t i = 1; i < SERVOS; i++)
+    {
+        uint8_t c = order[i], j;
+        for (j = i; j && servos[order[j-1]].width > servos[c].width; j--) order[j] = order[j-1];
+        order[j] = c;
+    }
+
+    // servos with the same width share an edge
+    schedule *s = &schedules[!active];
+    uint8_t n = 0;
+    memset(s->on, 0, sizeof s->on);
+    for (uint8_t i = 0; i < SERVOS; i++)
+    {
+        uint8_t c = order[i];
+        uint16_t w = servos[c].width;
+        if (!w) continue;                           // off
+        s->on[port[c]] |= bit[c];
+        if (!n || s->edge[n-1].value != w)
+        {
+            s->edge[n].value = w;
+            memset(s->edge[n].off, 0, sizeof s->edge[n].off);
+            n++;
+        }
+        s->edge[n-1].off[port[c]] |= bit[c];
+    }
+    s->edge[n].value = 0xFFFF;                      // never matches
+    pending = 1;
+    changed = 0;
+}
+
+// LEAD ticks before TOP, wait for the start of frame
+ISR(TIMER1_COMPB_vect)
+{
+    if (pending)
+    {
+        active ^= 1;
+        pending = 0;
+    }
+    while (TCNT1 >= TOP - LEAD);                    // until the count wraps, unless it already has
+    schedule *s = &schedules[active];
+    PORTB |= s->on[0];
+    PORTC |= s->on[1];
+    PORTD |= s->on[2];
+    next = 0;
+    OCR1A = s->edge[0].value - LEAD;                // at least SERVO_MIN away
+
+    if (move() || changed) build();                 // for the next frame
+}
+
+// LEAD ticks before an edge
+ISR(TIMER1_COMPA_vect)
+{
+    schedule *s = &schedules[active];
+    uint16_t v;
+
+    // handle all edges due before this interrupt could be requested again
+    while ((v = s->edge[next].value) <= TCNT1 + LEAD + 2)
+    {
+        while (TCNT1 < v);
+        PORTB &= (uint8_t)~s->edge[next].off[0];
+        PORTC &= (uint8_t)~s->edge[next].off[1];
+        PORTD &= (uint8_t)~s->edge[next].off[2];
+        next++;
+    }
+    OCR1A = v - LEAD;
+}
+
+// Set servo width and stop moving, interrupts must be disabled
+static void stop(uint8_t servo, uint16_t width)
+{
+    servos[servo].width = width;
+    servos[servo].frames = 0;
+    changed = 1;
+#ifdef THREAD
+    release(&moved[servo]);
+#endif
+}
+
+// Return width in ticks, clamped
+static uint16_t ticks(uint16_t us)
+{
+    if (us < SERVO_MIN) us = SERVO_MIN;
+    if (us > SERVO_MAX) us = SERVO_MAX;
+    return TICKS(us);
+}
+
+// Set servo width in uS, or 0 for off
+void set_servo(uint8_t servo, uint16_t us)
+{
+    if (servo >= SERVOS) return;
+    uint8_t sreg = SREG;
+    cli();
+    stop(servo, us ? ticks(us) : 0);
+    SREG = sreg;
+}
+
+// Move servo to us over ms milliseconds
+void move_servo(uint8_t servo, uint16_t us, uint16_t ms)
+{
+    if (servo >= SERVOS) return;
+    uint16_t target = ticks(us);
+    uint16_t frames = ((uint32_t)ms*1000 + SERVO_FRAME/2) / SERVO_FRAME;
+
+    uint8_t sreg = SREG;
+    cli();
+    if (frames < 2 || !servos[servo].width) stop(servo, target); // no time or off, just set it
+    else
+    {
+        servos[servo].position = (uint32_t)servos[servo].width << 8;
+        servos[servo].step = (((int32_t)target - servos[servo].width) << 8) / frames;
+        servos[servo].target = target;
+        servos[servo].frames = frames;
+    }
+    SREG = sreg;
+}
+
+// Return frames until the move ends, the ISR changes them
+static uint16_t remaining(uint8_t servo)
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t frames = *(volatile uint16_t *)&servos[servo].frames;
+    SREG = sreg;
+    return frames;
+}
+
+// Return true if servo is moving
+bool moving_servo(uint8_t servo)
+{
+    return (servo < SERVOS) && remaining(servo);
+}
+
+// Wait for servo to finish moving
+void wait_servo(uint8_t servo)
+{
+    if (servo >= SERVOS) return;
+    sei();
+#ifdef THREAD
+    while (remaining(servo)) suspend(&moved[servo]);
+#else
+    while (remaining(servo));
+#endif
+}
+
+// Init the output pins and start the timer
+void init_servo(void)
+{
+    for (uint8_t c = 0; c < SERVOS; c++)
+    {
+        gpio g;
+        memcpy_P(&g, &pins[c], sizeof g);
+        port[c] = (g.port == &PORTB) ? 0 : (g.port == &PORTC) ? 1 : 2;
+        bit[c] = g.bit;
+        clr_gpio((&g));
+        out_gpio((&g));
+        order[c] = c;
+        servos[c].width = 0;
+        servos[c].frames = 0;
+    }
+    schedules[0].edge[0].value = 0xFFFF;            // empty schedule
+    active = 0;
+    pending = 0;
+    changed = 1;
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1 = 0;
+    ICR1 = TOP;
+    OCR1A = 0xFFFF;
+    OCR1B = TOP - LEAD;
+    TIFR1 = (1 << OCF1A) | (1 << OCF1B);
+    TIMSK1 = (1 << OCIE1A) | (1 << OCIE1B);
+    TCCR1B = 0x18 | 2;                              // CTC mode 12, TOP=ICR1, clock/8
+}
@@ -0,0 +1,31 @@
+// Hobby servo driver, drives any number of servos on arbitrary GPIOs via
+// TIMER1. So it can't be used with USE_PWM_TIMER1, softpwm or the nec driver.
+//
+// Define in main.h:
+//      SERVO_PINS - list of servo GPIOs in braces, e.g. {GPIO02}, {GPIO03}
+//      SERVO_FRAME - frame period in uS, default 20000 (50 Hz), max 32000
+//      SERVO_MIN, SERVO_MAX - pulse width limits in uS, default 500 and 2500
+//
+// All servo pulses start together at the start of the frame, and end in order
+// of width. Pulse widths have 0.5 uS resolution. The compare interrupt fires a
+// few uS early and spins to the exact tick, so an edge is only late if another
+// interrupt delays it by more than that.
+
+// Init the servo pins (low) and start the timer, all servos are off
+void init_servo(void);
+
+// Set servo pulse width in uS, clamped to SERVO_MIN and SERVO_MAX, or 0 to
+// stop sending pulses. Takes effect in the next frame, and stops any move in
+// progress.
+void set_servo(uint8_t servo, uint16_t us);
+
+// Move servo from its current pulse width to us over ms milliseconds. The
+// width is interpolated by the timer interrupt, once per frame, so no thread is
+// involved. The servo must be on.
+void move_servo(uint8_t servo, uint16_t us, uint16_t ms);
+
+// Return true if servo is moving
+bool moving_servo(uint8_t servo);
+
+// Wait until servo has finished moving
+void wait_servo(uint8_t servo);
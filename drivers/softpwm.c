@@ -0,0 +1,159 @@
+// Software PWM via TIMER1 in CTC mode with TOP=ICR1. The compare B interrupt
+// at count 0 starts the period and the compare A interrupt walks a schedule of
+// edges sorted by duty. Schedules are double buffered, set_softpwm() builds
+// the spare one and the compare B interrupt swaps them.
+
+#ifndef SOFTPWM_PINS
+#error "Must define SOFTPWM_PINS"
+#endif
+
+#ifdef USE_PWM_TIMER1
+#error "softpwm conflicts with USE_PWM_TIMER1"
+#endif
+
+#ifndef SOFTPWM_BITS
+#define SOFTPWM_BITS 8
+#endif
+#if SOFTPWM_BITS < 4 || SOFTPWM_BITS > 15
+#error "SOFTPWM_BITS must be 4 to 15"
+#endif
+
+#ifndef SOFTPWM_CLOCK
+#define SOFTPWM_CLOCK 3
+#endif
+#if SOFTPWM_CLOCK < 1 || SOFTPWM_CLOCK > 5
+#error "SOFTPWM_CLOCK must be 1 to 5"
+#endif
+
+#define TOP ((1U << SOFTPWM_BITS) - 1)
+
+// Edges this close to the current count are handled immediately, they'd be
+// missed by the time OCR1A is written
+#if SOFTPWM_CLOCK == 1
+#define MARGIN 32
+#elif SOFTPWM_CLOCK == 2
+#define MARGIN 4
+#else
+#define MARGIN 1
+#endif
+
+static const gpio pins[] PROGMEM = { SOFTPWM_PINS };
+#define CHANNELS (sizeof(pins)/sizeof(gpio))
+
+// Outputs are grouped by port, 0=B, 1=C, 2=D
+static uint8_t port[CHANNELS], bit[CHANNELS];
+static uint16_t duty[CHANNELS];
+
+typedef struct
+{
+    uint8_t on[3];                                  // pins to set at start of period
+    struct
+    {
+        uint16_t value;                             // clear at this count, 0xFFFF ends the list
+        uint8_t off[3];                             // pins to clear
+    } edge[CHANNELS+1];
+} schedule;
+
+static schedule schedules[2];
+static volatile uint8_t active;                     // schedule in use by the ISR
+static volatile bool pending;                       // true if the spare schedule is ready
+static uint8_t next;                                // next edge in the active schedule
+
+// Clear pins for each edge that's due and set OCR1A for the next. Interrupt
+// context.
+static inline void edges(schedule *s)
+{
+    while (s->edge[next].value <= TCNT1 + MARGIN)
+    {
+        PORTB &= (uint8_t)~s->edge[next].off[0];
+        PORTC &= (uint8_t)~s->edge[next].off[1];
+        PORTD &= (uint8_t)~s->edge[next].off[2];
+        next++;
+    }
+    OCR1A = s->edge[next].value;
+}
+
+// At count 0, start of period
+ISR(TIMER1_COMPB_vect)
+{
+    if (pending)
+    {
+        active ^= 1;
+        pending = 0;
+    }
+    schedule *s = &schedules[active];
+    PORTB |= s->on[0];
+    PORTC |= s->on[1];
+    PORTD |= s->on[2];
+    next = 0;
+    edges(s);
+}
+
+ISR(TIMER1_COMPA_vect)
+{
+    edges(&schedules[active]);
+}
+
+// Build the spare schedule from duty[] and flag it for the ISR
+static void build(void)
+{
+    pending = 0;                                    // ISR can't swap now
+    schedule *s = &schedules[!active];
+    uint8_t n = 0;
+
+    memset(s->on, 0, sizeof s->on);
+    for (uint8_t c = 0; c < CHANNELS; c++)
+    {
+        uint16_t d = duty[c];
+        if (!d) continue;                           // always off
+        s->on[port[c]] |= bit[c];
+        if (d > TOP) continue;                      // always on
+
+        // insertion sort, channels with the same duty share an edge
+        uint8_t i;
+        for (i = 0; i < n && s->edge[i].value < d; i++);
+        if (i == n || s->edge[i].value != d)
+        {
+            memmove(&s->edge[i+1], &s->edge[i], (n-i) * sizeof s->edge[0]);
+            s->edge[i].value = d;
+            memset(s->edge[i].off, 0, sizeof s->edge[i].off);
+            n++;
+        }
+        s->edge[i].off[port[c]] |= bit[c];
+    }
+    s->edge[n].value = 0xFFFF;                      // never matches
+    pending = 1;
+}
+
+// Set channel duty 0 to 1 << SOFTPWM_BITS
+void set_softpwm(uint8_t channel, uint16_t value)
+{
+    if (channel >= CHANNELS) return;
+    duty[channel] = value;
+    build();
+}
+
+// Init the output pins and start the timer
+void init_softpwm(void)
+{
+    for (uint8_t c = 0; c < CHANNELS; c++)
+    {
+        gpio g;
+        memcpy_P(&g, &pins[c], sizeof g);
+        port[c] = (g.port == &PORTB) ? 0 : (g.port == &PORTC) ? 1 : 2;
+        bit[c] = g.bit;
+        clr_gpio((&g));
+        out_gpio((&g));
+        duty[c] = 0;
+    }
+    build();
+    TCCR1A = 0;
+    TCCR1B = 0;
+    TCNT1 = 0;
+    ICR1 = TOP;
+    OCR1A = 0xFFFF;
+    OCR1B = 0;
+    TIFR1 = (1 << OCF1A) | (1 << OCF1B);
+    TIMSK1 = (1 << OCIE1A) | (1 << OCIE1B);
+    TCCR1B = 0x18 | SOFTPWM_CLOCK;                  // CTC mode 12, TOP=ICR1
+}
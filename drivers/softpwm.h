@@ -0,0 +1,29 @@
+// Software PWM on arbitrary GPIOs, via TIMER1. So it can't be used with
+// USE_PWM_TIMER1 or the nec driver.
+//
+// Define in main.h:
+//      SOFTPWM_PINS - list of channel GPIOs in braces, e.g. {GPIO02}, {GPIO03}
+//      SOFTPWM_BITS - resolution in bits, default 8
+//      SOFTPWM_CLOCK - timer prescaler 1 to 5 (clock/1, 8, 64, 256, 1024), default 3
+// The PWM frequency is F_CPU/(prescale << SOFTPWM_BITS), e.g. 976 Hz with the
+// defaults at 16 MHz.
+//
+// All outputs go high at the start of the period, a compare interrupt clears
+// them in order of duty. Channels with the same duty share an interrupt and
+// pins on the same port are cleared with one write. The interrupt load is
+// roughly (70 + 90*N) cycles per period, where N is the number of distinct
+// duty values, against a period of prescale << BITS cycles (estimated from
+// the instruction count, not measured):
+//      8 bits, clock/64:   4 channels 2.6%, 8 channels 4.8%, 16 channels 9.2%
+//      10 bits, clock/64:  4 channels 0.7%, 8 channels 1.2%, 16 channels 2.3%
+//      8 bits, clock/8:    4 channels 21%, 8 channels 38%, 16 channels 74%
+// Duty values closer than a few timer ticks are handled by the same
+// interrupt, so the load can't exceed the above but closely spaced edges may
+// be a tick or two late.
+
+// Init the output pins (low) and start the timer
+void init_softpwm(void);
+
+// Set a channel's duty from 0 (off) to 1 << SOFTPWM_BITS (on). Takes effect at
+// the start of the next period.
+void set_softpwm(uint8_t channel, uint16_t duty);
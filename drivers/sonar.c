@@ -0,0 +1,154 @@
+// SR04 sweep scheduler. Echo edges are timestamped with get_micros() by a pin
+// change handler per sensor, the scheduler thread triggers each group then
+// sleeps for the slot and collects the results.
+
+#ifndef SONAR_SENSORS
+#error "Must define SONAR_SENSORS"
+#endif
+
+#ifndef THREAD
+#error "sonar requires threads"
+#endif
+
+#ifndef SONAR_SLOT
+#define SONAR_SLOT 35
+#endif
+
+#ifndef SONAR_CYCLE
+#define SONAR_CYCLE 100
+#endif
+
+#if SONAR_SLOT < 30
+#error "SONAR_SLOT must be at least 30 to allow for the longest echo"
+#endif
+
+#define MAXECHO 25000                                   // longer echo means nothing was in range
+
+static const sonar_sensor config[] PROGMEM = { SONAR_SENSORS };
+#define SENSORS (sizeof(config)/sizeof(sonar_sensor))
+_Static_assert(SENSORS <= 8, "Too many SONAR_SENSORS");
+
+static gpio trigger[SENSORS], echo[SENSORS];
+static uint8_t group[SENSORS];
+static uint8_t groups;
+
+// Interrupt state
+static volatile uint8_t measuring;                      // bit per sensor, until the falling edge
+static volatile uint8_t rose;                           // bit per sensor, ECHO went high
+static uint32_t start[SENSORS];                         // when ECHO went high
+static uint32_t width[SENSORS];                         // echo width in uS
+
+static sonar_reading readings[SENSORS];
+static semaphore swept;                                 // released after each sweep
+static semaphore started;                               // released by init_sonar()
+
+// ECHO changed state, in interrupt context
+static void edge(uint8_t n, uint8_t state)
+{
+    uint32_t now = get_micros();
+    uint8_t bit = 1 << n;
+    if (!(measuring & bit)) return;
+    if (state)
+    {
+        start[n] = now;
+        rose |= bit;
+    }
+    else if (rose & bit)
+    {
+        width[n] = now - start[n];
+        measuring &= (uint8_t)~bit;
+    }
+}
+
+// pcint handlers don't know their pin, so one per sensor
+#define HANDLER(n) static void edge##n(uint8_t state) { edge(n, state); }
+HANDLER(0) HANDLER(1) HANDLER(2) HANDLER(3) HANDLER(4) HANDLER(5) HANDLER(6) HANDLER(7)
+static void (* const handlers[8])(uint8_t) = { edge0, edge1, edge2, edge3, edge4, edge5, edge6, edge7 };
+
+// Trigger the sensors in group g, return bits of the sensors triggered
+static uint8_t fire(uint8_t g)
+{
+    uint8_t bits = 0;
+    for (uint8_t n = 0; n < SENSORS; n++)
+    {
+        if (group[n] != g) continue;
+        bits |= 1 << n;
+        attach_pcint(&echo[n], handlers[n]);
+    }
+    cli();
+    rose &= (uint8_t)~bits;
+    measuring |= bits;
+    sei();
+    for (uint8_t n = 0; n < SENSORS; n++) if (bits & (1 << n)) set_gpio((&trigger[n]));
+    waituS(10);
+    for (uint8_t n = 0; n < SENSORS; n++) if (bits & (1 << n)) clr_gpio((&trigger[n]));
+    return bits;
+}
+
+// Publish the results of triggered sensors
+static void collect(uint8_t bits, uint32_t ticks)
+{
+    for (uint8_t n = 0; n < SENSORS; n++)
+    {
+        if (!(bits & (1 << n))) continue;
+        attach_pcint(&echo[n], NULL);
+        cli();
+        bool done = !(measuring & (1 << n)), responded = rose & (1 << n);
+        measuring &= (uint8_t)~(1 << n);
+        sei();
+        // Round trip time is ~58 uS per centimeter
+        readings[n].cm = !responded ? -2 : (!done || width[n] > MAXECHO) ? -1 : width[n]/58;
+        readings[n].ticks = ticks;
+    }
+}
+
+THREAD(sonar, 100)
+{
+    while (!groups) suspend(&started);
+    while (1)
+    {
+        uint32_t sweep = get_ticks();
+        for (uint8_t g = 0; g < groups; g++)
+        {
+            uint32_t t = get_ticks();
+            uint8_t bits = fire(g);
+            sleep_until(t + SONAR_SLOT);
+            collect(bits, t);
+        }
+        release_all(&swept);
+        sleep_until(sweep + SONAR_CYCLE);               // no sooner than the sensors allow
+    }
+}
+
+// Get the latest reading from sensor
+void get_sonar(uint8_t sensor, sonar_reading *r)
+{
+    if (sensor >= SENSORS) return;
+    *r = readings[sensor];                              // threads are cooperative, so this is consistent
+}
+
+// Suspend until the next sweep completes
+void wait_sonar(void)
+{
+    suspend(&swept);
+}
+
+// Init sensor pins and start the scheduler
+void init_sonar(void)
+{
+    for (uint8_t n = 0; n < SENSORS; n++)
+    {
+        sonar_sensor s;
+        memcpy_P(&s, &config[n], sizeof s);
+        trigger[n] = s.trigger;
+        echo[n] = s.echo;
+        group[n] = s.group;
+        if (s.group >= groups) groups = s.group + 1;
+        clr_gpio((&trigger[n]));
+        out_gpio((&trigger[n]));
+        in_gpio((&echo[n]));
+        readings[n].cm = -2;
+        readings[n].ticks = 0;
+    }
+    release(&started);                                  // wake the thread
+}
@@ -0,0 +1,41 @@
+// Concurrent ranging with several SR04 ultrasonic modules, requires threads
+// and the pcint driver.
+//
+// Define SONAR_SENSORS in main.h as a list of sensors, each given as:
+//      SONAR(group, trigger, echo)
+// For example, four sensors where front and back fire together, then left
+// and right:
+//      #define SONAR_SENSORS SONAR(0, GPIO02, GPIO08), SONAR(1, GPIO03, GPIO09), SONAR(0, GPIO04, GPIO10), SONAR(1, GPIO05, GPIO11)
+//
+// A background thread fires the groups in turn, one per SONAR_SLOT ticks
+// (default 35). All sensors in a group are triggered at once and their echoes
+// are timed concurrently by pin change interrupts, so put sensors that can
+// hear each other in different groups. A whole sweep takes at least
+// SONAR_CYCLE ticks (default 100, as for get_sr04()), the minimum interval
+// between triggers of the same sensor. Up to 8 sensors are supported.
+//
+// Each sensor's latest distance is published in a table with the tick count
+// at which it was triggered.
+
+typedef struct
+{
+    uint8_t group;
+    gpio trigger, echo;
+} sonar_sensor;
+
+#define SONAR(group, trigger, echo) { group, {trigger}, {echo} }
+
+typedef struct
+{
+    int16_t cm;         // distance in cm, or -1 if no echo, or -2 if the sensor didn't respond
+    uint32_t ticks;     // when measured, 0 if never
+} sonar_reading;
+
+// Init sensors and start sweeping
+void init_sonar(void);
+
+// Get the latest reading from sensor
+void get_sonar(uint8_t sensor, sonar_reading *r);
+
+// Suspend until the next sweep completes
+void wait_sonar(void);
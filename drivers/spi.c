@@ -10,11 +10,27 @@
 #error Must define SPI_CLOCK 0 to 3
 #endif
 
-#ifdef THREAD
-static semaphore complete, mutex=available(1);
-#endif
+// Transaction queue, the head is the transaction in progress
+static spi_xfer * volatile head, * volatile tail;
 
 static volatile uint8_t *txd, *rxd, txc, rxc, rxs;
+static bool finishing;                  // true while a done() callback is running
+
+// Start the transaction at the head of the queue, interrupts must be disabled
+static void start(void)
+{
+    spi_xfer *x=head;
+    txd=x->txdata; txc=x->txcount; rxs=x->rxskip; rxd=x->rxdata; rxc=x->rxcount;
+    if (x->ss) clr_gpio(x->ss); else CLR_GPIO(SPI_SS); // take SS low
+    SPSR; SPDR;                         // reset latent interrupt
+    if (txc)                            // maybe send first byte
+    {
+        SPDR=*txd;                      // note ISR pre-increments
+        txc--;
+    } else SPDR=0;                      // else send zero
+    SPCR |= 0x80;                       // let ISR do the rest
+}
+
 ISR(SPI_STC_vect)
 {
     if (rxs)                            // receive skip?
@@ -38,13 +54,58 @@ ISR(SPI_STC_vect)
     }
     else                                // transfer complete
     {
-        SPCR &= 0x7f;                   // clear SPIE
-#ifdef THREAD        
-        release(&complete);             // unblock waiting thread
-#endif        
+        spi_xfer *x=head;
+        if (x->ss) set_gpio(x->ss); else SET_GPIO(SPI_SS); // take SS high
+        head=x->next;                   // dequeue it
+        x->busy=0;
+        finishing=1;                    // submit_spi() must not start
+        if (x->done) x->done(x);        // tell the owner, which may submit more
+#ifdef THREAD
+        else release(&x->complete);     // or unblock waiting thread
+#endif
+        finishing=0;
+        if (head) start();              // chain the next transaction
+        else SPCR &= 0x7f;              // or clear SPIE
     }
 }
 
+// Queue a transaction and return true, or false if it's invalid or already
+// queued. The transaction starts immediately if the bus is idle.
+bool submit_spi(spi_xfer *x)
+{
+    if ((!x->txcount && !x->rxcount) || (x->txcount && !x->txdata) ||
+        (x->rxcount && !x->rxdata) || (x->rxskip && !x->rxcount)) return 0;
+    uint8_t sreg=SREG;
+    cli();
+    if (x->busy)
+    {
+        SREG=sreg;
+        return 0;
+    }
+    x->busy=1;
+    x->next=NULL;
+    if (head) tail->next=x;             // append to queue
+    else
+    {
+        head=x;                         // or become the head
+        if (!finishing) start();        // and start now, unless the ISR will
+    }
+    tail=x;
+    SREG=sreg;
+    return 1;
+}
+
+// Wait for a submitted transaction to complete
+void wait_spi(spi_xfer *x)
+{
+    sei();                              // make sure interrupts are enabled
+#ifdef THREAD
+    while (x->busy) suspend(&x->complete);
+#else
+    while (x->busy);
+#endif
+}
+
 // Perform a single SPI transfer, sending txcount bytes from *txdata while
 // simultaneously receiving rxcount bytes to *rxdata. Note txdata and rxdata
 // can safely point to the same memory buffer.
@@ -59,30 +120,9 @@ ISR(SPI_STC_vect)
 // Returns true when done, or false if arguments are invalid.
 bool xfer_spi(uint8_t *txdata, uint8_t txcount, uint8_t rxskip, uint8_t *rxdata, uint8_t rxcount)
 {
-    if ((!txcount && !rxcount) || (txcount && !txdata) ||
-        (rxcount && !rxdata) || (rxskip && !rxcount)) return 0;
-#ifdef THREAD        
-    suspend(&mutex);
-#endif    
-    txd=txdata; txc=txcount; rxs=rxskip; rxd=rxdata; rxc=rxcount;
-    CLR_GPIO(SPI_SS);                   // take SS low
-    SPSR; SPDR;                         // reset latent interrupt
-    if (txc)                            // maybe send first byte
-    {
-        SPDR=*txd;                      // note ISR pre-increments
-        txc--;
-    } else SPDR=0;                      // else send zero
-    SPCR |= 0x80;                       // let ISR do the rest
-    sei();                              // make sure interrupts are enabled
-#ifdef THREAD    
-    suspend(&complete);                 // wait for transfer complete
-#else
-    while (SPCR & 0x80);
-#endif    
-    SET_GPIO(SPI_SS);                   // take SS high
-#ifdef THREAD    
-    release(&mutex);
-#endif    
+    spi_xfer x = { .txdata=txdata, .txcount=txcount, .rxskip=rxskip, .rxdata=rxdata, .rxcount=rxcount };
+    if (!submit_spi(&x)) return 0;
+    wait_spi(&x);
     return 1;
 }
 
@@ -90,15 +130,14 @@ bool xfer_spi(uint8_t *txdata, uint8_t txcount, uint8_t rxskip, uint8_t *rxdata,
 void init_spi(void)
 {
 #ifdef THREAD
-    suspend(&mutex);
-#endif    
+    while (head) yield();               // let queued transactions finish
+#else
+    while (head);
+#endif
     SET_GPIO(SPI_SS);                   // SS high
     OUT_GPIO(SPI_SS);                   // SS is output
     IN_GPIO(SPI_MISO);                  // MISO is input
     OUT_GPIO(SPI_MOSI);                 // MOSI is output
     OUT_GPIO(SPI_SCK);                  // SCK is output
     SPCR = 0x40|(SPI_ORDER<<5)|0x10|(SPI_MODE<<2)|SPI_CLOCK;
-#ifdef THREAD    
-    release(&mutex);
-#endif    
 }
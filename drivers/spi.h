@@ -1,3 +1,33 @@
 // SPI driver
 void init_spi(void);
 bool xfer_spi(uint8_t *txdata, uint8_t txcount, uint8_t rxskip, uint8_t *rxdata, uint8_t rxcount);
+
+// An asynchronous SPI transaction. The caller fills in the transfer
+// parameters, which have the same meaning as the xfer_spi() arguments, and
+// passes the struct to submit_spi(). The struct must remain valid until the
+// transaction completes.
+typedef struct spi_xfer
+{
+    struct spi_xfer *next;              // queue link, managed by the driver
+    uint8_t *txdata, txcount;           // data to send
+    uint8_t rxskip;                     // received bytes to ignore
+    uint8_t *rxdata, rxcount;           // where to put received data
+    gpio *ss;                           // slave select, or NULL to use SPI_SS
+    void (*done)(struct spi_xfer *x);   // if not NULL, called from the ISR on completion
+    volatile bool busy;                 // true while queued or in progress
+#ifdef THREAD
+    semaphore complete;                 // released on completion (by done() if set)
+#endif
+} spi_xfer;
+
+// Queue a transaction and return true, or return false if the transaction is
+// invalid or already queued. Can be called from an ISR, including from a
+// done() callback. Queued transactions are started back-to-back by the ISR.
+bool submit_spi(spi_xfer *x);
+
+// Wait for a submitted transaction to complete. If x->done is set, the
+// callback must release x->complete when it's finished with the transaction.
+void wait_spi(spi_xfer *x);
+
+// Return true if transaction is queued or in progress
+#define busy_spi(x) ((x)->busy)
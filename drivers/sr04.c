@@ -1,74 +1,109 @@
 // SR04 ultrasonic ranging driver
 
-// 8-cycle loops in N microseconds, for MHZ == 8 or 16
-#define uS(N) (N*(MHZ/8U))
-
 // The SR04 module has TRIG input and ECHO output, normally both low. When the
 // module sees TRIG go high for 10uS it transmits a burst of ultrasonic pulses
 // and sets ECHO high. ECHO goes low when echo of the burst is received, or on
 // timeout.
 
-// get_sr04() can spin with interrupts disabled for up to 26 mS
-#if !defined(TICKMS) || TICKMS < 16
-#warning TICKMS should be at least 16 to avoid losing ticks
+// The ECHO edges are timestamped with get_micros() by a pin change handler,
+// so the resolution is 8 to 128 uS (about 1 to 2 cm) depending on TICKMS.
+
+#ifndef SR04_TIMEOUT
+#define SR04_TIMEOUT 30                 // ticks to wait for ECHO to go low
 #endif
 
+#define MAXECHO 25000                   // longer echo means nothing was in range
+
+static volatile bool measuring;         // true until the falling edge or timeout
+static volatile bool rose;              // ECHO went high
+static uint32_t start;                  // when it went high
+static volatile uint32_t width;         // echo pulse width in uS
+
+#ifdef THREAD
+static semaphore mutex = available(1);  // one measurement at a time
+static semaphore echoed;                // released at the falling edge or timeout
+static semaphore armed;                 // released to start the timeout
+static volatile uint8_t serial;         // incremented for each measurement
+
+// Release the waiter if measurement doesn't complete in time
+THREAD(sr04timeout, 64)
+{
+    while (1)
+    {
+        suspend(&armed);
+        uint8_t s = serial;
+        sleep_ticks(SR04_TIMEOUT);
+        cli();
+        if (measuring && serial == s)
+        {
+            measuring = 0;
+            release(&echoed);
+        }
+        sei();
+    }
+}
+#endif
+
+// ECHO changed state, in interrupt context
+static void edge(uint8_t state)
+{
+    uint32_t now = get_micros();
+    if (!measuring) return;
+    if (state)
+    {
+        start = now;
+        rose = 1;
+    }
+    else if (rose)
+    {
+        width = now - start;
+        measuring = 0;
+#ifdef THREAD
+        release(&echoed);
+#endif
+    }
+}
+
 // Given trigger and echo gpios, trigger the SR04 and return the echo pulse
 // width converted to centimeters. Return -2 if SR04 didn't respond, or -1 if
 // no echo was received within 25 mS.
-// Do not call more often than once per 100 mS.
 int16_t get_sr04(gpio *trigger, gpio *echo)
 {
+#ifdef THREAD
+    suspend(&mutex);
+#endif
     out_gpio(trigger);
     in_gpio(echo);
-
     clr_gpio(trigger);
+
+    rose = 0;
+    width = 0xFFFFFFFF;
+    measuring = 1;
+    attach_pcint(echo, edge);
+
     waituS(10);
     set_gpio(trigger);
     waituS(10);
-
-    uint8_t sreg=SREG;
-    cli();
     clr_gpio(trigger);
+    sei();
 
-    // wait 1mS for echo to go high
-    uint16_t loops=uS(1000);
-    asm volatile (
-        // loop is 8 cycles
-        "; loops=%0 (%a0) bit=%2 *pin=%3 (%a3)\n"
-        "1: sbiw %a0,  \n" // 2, decrement loops
-        "   breq 2f    \n" // 1, exit if zero
-        "   ld r0, %a3 \n" // 2, get *pin
-        "   and r0, %2 \n" // 1, test bit
-        "   breq 1b    \n" // 2, repeat if clear
-        "2:            \n"
-        : "=&e" (loops)
-        : "0" (loops), "r" (echo->bit), "e" (echo->pin)
-        : "r0"
-    );
-    if (!loops)
-    {
-        SREG = sreg;
-        return -2;
-    }
-    // wait 25 mS for echo to go low, loop is 8 cycles
-    loops=uS(25000);
-    asm volatile (
-        // loop is 8 cycles
-        "; loops=%0 (%a0) bit=%2 *pin=%3 (%a3)\n"
-        "1: sbiw %a0, 1\n" // 2, decrement loops
-        "   breq 2f    \n" // 1, exit if zero
-        "   ld r0, %a3 \n" // 2, get *pin
-        "   and r0, %2 \n" // 1, test bit
-        "   brne 1b    \n" // 2, repeat if set
-        "2:            \n"
-        : "=&e" (loops)
-        : "0" (loops), "r" (echo->bit), "e" (echo->pin)
-        : "r0"
-    );
-    SREG = sreg;
-    if (!loops) return -1;
+#ifdef THREAD
+    serial++;
+    release(&armed);
+    suspend(&echoed);
+#else
+    uint32_t until = get_ticks() + SR04_TIMEOUT;
+    while (measuring && !expired(until)) sleep_cpu();
+    measuring = 0;
+#endif
+
+    attach_pcint(echo, NULL);
+#ifdef THREAD
+    release(&mutex);
+#endif
+    if (!rose) return -2;
+    if (width > MAXECHO) return -1;
 
     // Round trip time is ~58 uS per centimeter
-    return (uS(25000)-loops)/uS(58);
+    return width/58;
 }
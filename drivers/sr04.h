@@ -1,7 +1,9 @@
 // Support for SR04 ultrasonic ranging module, requires an output pin for
-// trigger and an input pin for echo.
+// trigger and an input pin for echo. The echo pulse is timed by the pcint
+// driver's pin change interrupt, so pcint must also be in DRIVERS.
 
 // Trigger SR04 measurement cycle, return distance in cm, or -1 if timeout, or
-// -2 if device did not respond. This function may block up to 25 milliseconds,
-// and should not be called more often than once per 100 mS.
+// -2 if device did not respond. This function may take up to 30 milliseconds
+// but doesn't disable interrupts, and in threaded projects other threads run
+// meanwhile. It should not be called more often than once per 100 mS.
 int16_t get_sr04(gpio *trigger, gpio *echo);
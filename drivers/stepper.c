@@ -1,12 +1,58 @@
-// Unipolar stepper motor driver, using TIMER0.
+// Unipolar stepper motor driver, using TIMER0 (or TIMER1 if STEPPER_TIMER1 is
+// defined). Or bipolar with STEPPER_MICRO, using TIMER1 to step and TIMER0
+// for PWM.
 
+#ifdef STEPPER_MICRO
+#if STEPPER_MICRO != 4 && STEPPER_MICRO != 8 && STEPPER_MICRO != 16
+#error "STEPPER_MICRO must be 4, 8 or 16"
+#endif
+#ifdef STEPPER_FULL
+#error "STEPPER_MICRO conflicts with STEPPER_FULL"
+#endif
+#ifdef USE_PWM_TIMER0
+#error "STEPPER_MICRO conflicts with USE_PWM_TIMER0"
+#endif
+#ifndef STEPPER_TIMER1
+#define STEPPER_TIMER1
+#endif
+#ifndef STEPPER_PWM_CLOCK
+#define STEPPER_PWM_CLOCK 2         // clock/8
+#endif
+#endif
+
+#ifdef STEPPER_TIMER1
+#define FMAX ((MHZ*1000000)/8)      // timer 1 runs at CPU clock / 8
+#define FMIN ((FMAX+65535)/65536)   // min stepper frequency is MAX/65536
+#define FRAC 0                      // ramp table has whole clocks
+#define TCCRA TCCR1A
+#define TCCRB TCCR1B
+#define TCNT TCNT1
+#define OCRA OCR1A
+#define TIFR TIFR1
+#define TIMSK TIMSK1
+#define CLOCK 2                     // clock/8
+#define COMPA_vect TIMER1_COMPA_vect
+#ifdef USE_PWM_TIMER1
+#error "STEPPER_TIMER1 conflicts with USE_PWM_TIMER1"
+#endif
+#else
 #define FMAX ((MHZ*1000000)/1024)   // max stepper frequency is CPU clock / 1024
 #define FMIN (FMAX/256)             // min stepper frequency is MAX/256
+#define FRAC 7                      // ramp table has clocks * 128
+#define TCCRA TCCR0A
+#define TCCRB TCCR0B
+#define TCNT TCNT0
+#define OCRA OCR0A
+#define TIFR TIFR0
+#define TIMSK TIMSK0
+#define CLOCK 5                     // clock/1024
+#define COMPA_vect TIMER0_COMPA_vect
+#endif
 
 #ifndef STEPPER_FAST_HZ
 #define STEPPER_FAST_HZ 1500
 #endif
-#if (STEPPER_FAST_HZ > FMAX)
+#if (STEPPER_FAST_HZ > FMAX) || (STEPPER_FAST_HZ > 20000)
 #error "STEPPER_FAST_HZ out of range"
 #endif
 
@@ -17,12 +63,42 @@
 #error "STEPPER_SLOW_HZ out of range"
 #endif
 
-// Timer ticks corresponding to minimum and maximum stepper frequency (round up, to lower frequency)
-#define FAST_CLOCKS ((FMAX+STEPPER_FAST_HZ-1)/STEPPER_FAST_HZ)
-#define SLOW_CLOCKS ((FMAX+STEPPER_SLOW_HZ-1)/STEPPER_SLOW_HZ)
+#ifndef STEPPER_ACCEL
+#define STEPPER_ACCEL 20000
+#endif
 
-// Steps required to decelerate the stepper from fast to slow
-#define STOP_STEPS (SLOW_CLOCKS-FAST_CLOCKS)
+// Steps required to accelerate the stepper from slow to fast, or decelerate
+// from fast to slow. With constant acceleration v^2 = u^2 + 2as. The S-curve
+// is 1.5 times longer for the same peak acceleration.
+#define V2 (1L*STEPPER_FAST_HZ*STEPPER_FAST_HZ - 1L*STEPPER_SLOW_HZ*STEPPER_SLOW_HZ)
+#ifdef STEPPER_SCURVE
+#define RAMP_STEPS ((3*V2 + 2*STEPPER_ACCEL) / (4*STEPPER_ACCEL))
+#else
+#define RAMP_STEPS ((V2 + STEPPER_ACCEL) / (2*STEPPER_ACCEL))
+#endif
+#if RAMP_STEPS > 32767
+#error "STEPPER_ACCEL is too low"
+#endif
+#if RAMP_STEPS < 1
+#undef RAMP_STEPS
+#define RAMP_STEPS 1
+#endif
+
+// The ramp table has the step period in timer clocks << FRAC at 257 points
+// along the ramp, and is interpolated between. It's computed by the compiler,
+// velocity at fraction u of the ramp is the constant acceleration solution
+// sqrt(slow^2 + (fast^2-slow^2)*u), or for the S-curve
+// slow + (fast-slow)*(3u^2-2u^3), which starts and ends with no acceleration.
+#ifdef STEPPER_SCURVE
+#define VELOCITY(u) (STEPPER_SLOW_HZ + (STEPPER_FAST_HZ-STEPPER_SLOW_HZ)*(u)*(u)*(3-2*(u)))
+#else
+#define VELOCITY(u) __builtin_sqrt(1.0*STEPPER_SLOW_HZ*STEPPER_SLOW_HZ + 1.0*V2*(u))
+#endif
+#define PERIOD(i) (uint16_t)(1.0*FMAX*(1 << FRAC)/VELOCITY((i)/256.0) + 0.5)
+#define PERIOD4(i) PERIOD(i), PERIOD(i+1), PERIOD(i+2), PERIOD(i+3)
+#define PERIOD16(i) PERIOD4(i), PERIOD4(i+4), PERIOD4(i+8), PERIOD4(i+12)
+#define PERIOD64(i) PERIOD16(i), PERIOD16(i+16), PERIOD16(i+32), PERIOD16(i+48)
+static const uint16_t periods[257] PROGMEM = { PERIOD64(0), PERIOD64(64), PERIOD64(128), PERIOD64(192), PERIOD(256) };
 
 // Coil GPIOs
 #if !defined(STEPPER_N) || !defined(STEPPER_E) || !defined(STEPPER_S) || !defined(STEPPER_W)
@@ -34,23 +110,152 @@
 #define SOUTH 4
 #define WEST 8
 
-#ifdef STEPPER_FULL    // full step
+#ifdef STEPPER_MICRO   // micro step
+
+// Coil current is sin or cos of the phase angle, in quarter waves of 16 steps
+#define SINE(i) (uint8_t)(255*__builtin_sin((i)*3.14159265/32) + 0.5)
+static const uint8_t sine[17] PROGMEM =
+{
+    SINE(0), SINE(1), SINE(2), SINE(3), SINE(4), SINE(5), SINE(6), SINE(7), SINE(8),
+    SINE(9), SINE(10), SINE(11), SINE(12), SINE(13), SINE(14), SINE(15), SINE(16)
+};
+
+// Coils on OC0A and OC0B pins use hardware PWM, otherwise the timer 0
+// interrupts do it
+#define HARDWARE_A (PORT_GPIO(STEPPER_N) == PORT_GPIO(PWM0) && BIT_GPIO(STEPPER_N) == BIT_GPIO(PWM0))
+#define HARDWARE_B (PORT_GPIO(STEPPER_E) == PORT_GPIO(PWM1) && BIT_GPIO(STEPPER_E) == BIT_GPIO(PWM1))
+
+// A microstep is passed to the overflow interrupt, which writes OCR0A/B just
+// after BOTTOM so they take effect at the next BOTTOM, then switches the
+// polarity pins at the following overflow to match. The pins aren't buffered,
+// so setting them with OCR0A/B would reverse a coil for the rest of the
+// current PWM period.
+static uint8_t nexta, nextb, nextpolarity;  // microstep to load
+static bool pending;                        // true if there's one to load
+static uint8_t polarity;                    // SOUTH and WEST to set when loaded takes effect
+static bool loaded;                         // true if OCR0A/B were written last period
+
+// Set the polarity pins
+static void polarize(uint8_t p)
+{
+    if (p & SOUTH) SET_GPIO(STEPPER_S); else CLR_GPIO(STEPPER_S);
+    if (p & WEST) SET_GPIO(STEPPER_W); else CLR_GPIO(STEPPER_W);
+}
+
+ISR(TIMER0_OVF_vect)
+{
+    if (loaded)
+    {
+        polarize(polarity);         // OCR0A/B have just been updated
+        loaded = 0;
+    }
+    if (pending)
+    {
+        OCR0A = nexta;              // double buffered, takes effect at the
+        OCR0B = nextb;              // next BOTTOM
+        polarity = nextpolarity;
+        loaded = 1;
+        pending = 0;
+    }
+    else if (!loaded && HARDWARE_A && HARDWARE_B) TIMSK0 = 0; // nothing to do until the next microstep
+    if (!HARDWARE_A && OCR0A) SET_GPIO(STEPPER_N);
+    if (!HARDWARE_B && OCR0B) SET_GPIO(STEPPER_E);
+}
+
+ISR(TIMER0_COMPA_vect)
+{
+    if (OCR0A != 255) CLR_GPIO(STEPPER_N);
+}
+
+ISR(TIMER0_COMPB_vect)
+{
+    if (OCR0B != 255) CLR_GPIO(STEPPER_E);
+}
+
+// Set coil currents for microstep phase, via the overflow interrupt. Each
+// coil is driven sign-magnitude, the direction pin (S or W) selects the
+// polarity and the PWM pin (N or E) the current, inverted when the direction
+// pin is high. Interrupts must be disabled.
+static void microstep(uint8_t phase)
+{
+    uint8_t i = phase % (4*STEPPER_MICRO);
+    uint8_t quadrant = i / STEPPER_MICRO;
+    uint8_t n = (i % STEPPER_MICRO) * (16/STEPPER_MICRO);
+    uint8_t a = pgm_read_byte(&sine[(quadrant & 1) ? n : 16-n]);  // cos
+    uint8_t b = pgm_read_byte(&sine[(quadrant & 1) ? 16-n : n]);  // sin
+
+    uint8_t p = 0;
+    if (quadrant == 1 || quadrant == 2) p |= SOUTH, a = 255-a;
+    if (quadrant >= 2) p |= WEST, b = 255-b;
+    nexta = a;
+    nextb = b;
+    nextpolarity = p;
+    pending = 1;
+    TIMSK0 |= 1 << TOIE0;
+}
+
+// Start PWM at specified phase
+static void start_pwm(uint8_t phase)
+{
+    cli();
+    microstep(phase);
+    OCR0A = nexta;                  // timer is stopped, so load it now
+    OCR0B = nextb;
+    polarize(nextpolarity);
+    pending = loaded = 0;
+    sei();
+    TCNT0 = 0;
+    TCCR0A = (1 << WGM01) | (1 << WGM00) |           // fast PWM
+             (HARDWARE_A ? (1 << COM0A1) : 0) |     // connect OC0A
+             (HARDWARE_B ? (1 << COM0B1) : 0);      // connect OC0B
+    TIFR0 = 0xff;
+    TIMSK0 = (HARDWARE_A && HARDWARE_B) ? 0 :
+             (1 << TOIE0) | (HARDWARE_A ? 0 : (1 << OCIE0A)) | (HARDWARE_B ? 0 : (1 << OCIE0B));
+    TCCR0B = STEPPER_PWM_CLOCK;
+}
+
+// Stop PWM and turn coils off
+static void stop_pwm(void)
+{
+    TCCR0B = 0;
+    TIMSK0 = 0;
+    TCCR0A = 0;
+}
+
+#elif defined(STEPPER_FULL)    // full step
 static uint8_t phases[4] = { NORTH|EAST, SOUTH|EAST, SOUTH|WEST, NORTH|WEST };
-#else                  // half step
+#else                          // half step
 static uint8_t phases[8] = { NORTH, NORTH|EAST, EAST, SOUTH|EAST, SOUTH, SOUTH|WEST, WEST, NORTH|WEST };
 #endif
 
 static volatile bool forward;    // 1 = step forward, 0 = step backward
 static volatile uint16_t steps;  // number of steps to make
-static volatile uint8_t clocks;  // clocks per step, the update frequency
+static volatile uint16_t ramp;   // position on the ramp, 0 = slow to RAMP_STEPS = fast
+static uint8_t fraction;         // fraction of a clock carried to the next period
 static volatile uint8_t phase=0; // current motor phase
 
-ISR(TIMER0_COMPA_vect)
+// Return step period for current ramp position, in clocks << FRAC. The
+// period is from this step to the next, so use the speed half way between.
+static uint16_t period(void)
+{
+    // table index in 16.16 fixed point
+    uint32_t x = ramp * ((256UL << 16) / RAMP_STEPS) + ((128UL << 16) / RAMP_STEPS);
+    uint16_t i = x >> 16;
+    if (i >= 256) return pgm_read_word(&periods[256]);
+    uint16_t p = pgm_read_word(&periods[i]);
+    uint16_t d = p - pgm_read_word(&periods[i+1]); // periods get shorter
+    return p - (((uint32_t)d * (uint8_t)(x >> 8)) >> 8);
+}
+
+ISR(COMPA_vect)
 {
     if (!steps--)
     {
-        TIMSK0 = 0;         // disable interrupt
-        TCCR0B = 0;         // disable timer
+        TIMSK = 0;          // disable interrupt
+        TCCRB = 0;          // disable timer
+#ifdef STEPPER_MICRO
+        stop_pwm();
+#endif
         // coils off
         CLR_GPIO(STEPPER_N);
         CLR_GPIO(STEPPER_E);
@@ -63,22 +268,24 @@ ISR(TIMER0_COMPA_vect)
     if (forward) phase++; else phase--;
 
     // energize coils of interest
+#ifdef STEPPER_MICRO
+    microstep(phase);
+#else
     uint8_t p = phases[phase & (sizeof phases - 1)];
     if (p & NORTH) SET_GPIO(STEPPER_N); else CLR_GPIO(STEPPER_N);
     if (p & EAST) SET_GPIO(STEPPER_E); else CLR_GPIO(STEPPER_E);
     if (p & SOUTH) SET_GPIO(STEPPER_S); else CLR_GPIO(STEPPER_S);
     if (p & WEST) SET_GPIO(STEPPER_W); else  CLR_GPIO(STEPPER_W);
+#endif
 
-    if (clocks < SLOW_CLOCKS-steps)         // decelerate near the end
-    {
-        clocks = SLOW_CLOCKS-steps;
-        OCR0A = TCNT0+clocks-1;             // schedule next interrupt
-    }
-    else                                    // else maybe accelerate
-    {
-        OCR0A = TCNT0+clocks-1;             // schedule next interrupt
-        if (clocks > FAST_CLOCKS) clocks--;
-    }
+    if (steps < ramp) ramp--;                       // decelerate near the end
+    else if (steps > ramp && ramp < RAMP_STEPS) ramp++; // else maybe accelerate
+
+    // schedule next interrupt relative to this one, so latency doesn't
+    // accumulate
+    uint16_t c = period() + fraction;
+    OCRA += c >> FRAC;
+    fraction = c & ((1 << FRAC) - 1);
 }
 
 // Enable stepper driver
@@ -100,25 +307,25 @@ void start_stepper(int16_t s)
     bool f=1;               // forward if positive
     if (s < 0) f=0, s=-s;   // backward if negative
     cli();
-    if (TIMSK0)
+    if (TIMSK)
     {
-        // motor is running
+        // motor is running, it needs as many steps to stop as its ramp position
         if (!s || f==forward)
         {
             // already going in the right direction
-            if (s > STOP_STEPS) steps = s;
-            else if (steps > STOP_STEPS) steps = STOP_STEPS;
+            if (s > ramp) steps = s;
+            else if (steps > ramp) steps = ramp;
             sei();
             return;
         }
         // oops we have to go the other way
-        if (steps > STOP_STEPS) steps=STOP_STEPS;
+        if (steps > ramp) steps=ramp;
         sei();
         // spin here until motor stops...
 #ifndef THREAD
-        while (TIMSK0);
+        while (TIMSK);
 #else
-        while (TIMSK0) yield();
+        while (TIMSK) yield();
 #endif
     } else
     {
@@ -128,14 +335,18 @@ void start_stepper(int16_t s)
     // motor is stopped
     forward = f;            // Set direction
     steps = s;              // Set steps
-    clocks = SLOW_CLOCKS;   // Start at slowest speed
-    TCCR0B = 0;             // Stop timer
-    TCNT0 = 0;              // Count from now
-    OCR0A = 1;              // Interrupt soon
-    TIFR0 = 0xff;           // But not yet
-    TCCR0A = 0;             // Normal mode
-    TCCR0B = 5;             // Run timer at clock/1024
-    TIMSK0 = 2;             // Enable OCIE0A interrupt
+    ramp = 0;               // Start at slowest speed
+    fraction = 0;
+#ifdef STEPPER_MICRO
+    start_pwm(phase);       // Hold current phase
+#endif
+    TCCRB = 0;              // Stop timer
+    TCNT = 0;               // Count from now
+    OCRA = 1;               // Interrupt soon
+    TIFR = 0xff;            // But not yet
+    TCCRA = 0;              // Normal mode
+    TCCRB = CLOCK;          // Start timer
+    TIMSK = 2;              // Enable OCIEnA interrupt
 }
 
 // start the stepper and wait for it to stop
@@ -148,4 +359,3 @@ void run_stepper(int16_t s)
     while (running_stepper());
 #endif
 }
-
@@ -17,12 +17,35 @@
 // frequency, and must not skip at the fast frequency. Default is 500 and 1500
 // respectively.
 
+// The stepper accelerates from slow to fast and decelerates back at a constant
+// STEPPER_ACCEL steps/S/S, default 20000. If STEPPER_SCURVE is defined the
+// acceleration instead rises smoothly from 0 to a peak of STEPPER_ACCEL and
+// falls back, which avoids jerks at the ends of the ramp but makes it 1.5
+// times longer.
+
+// If STEPPER_MICRO is defined as 4, 8 or 16, the driver microsteps a bipolar
+// motor through an H-bridge with that many steps per full step, and steps and
+// frequencies are in microsteps. STEPPER_N and STEPPER_S drive one coil's
+// H-bridge inputs, STEPPER_E and STEPPER_W the other. N and E are PWMed with
+// the coil current from a sine table, while S and W select the polarity. If N
+// is PWM0 (OC0A) and E is PWM1 (OC0B) the PWM is done by hardware, otherwise
+// by timer 0 interrupts, which costs up to three interrupts per PWM period.
+// Each microstep takes effect at the start of a PWM period, one to two periods
+// after it's due, so the current and polarity always change together.
+// The PWM runs on TIMER0 in fast mode at clock/8 (7.8 kHz), or define
+// STEPPER_PWM_CLOCK as 1 for clock/1 (62.5 kHz) if the H-bridge can switch
+// that fast and the pins allow hardware PWM. Stepping uses TIMER1, as below.
+
+// The driver uses TIMER0 at clock/1024, which limits STEPPER_FAST_HZ to 15625
+// and step periods to multiples of 64uS (at 16MHz), or if STEPPER_TIMER1 is
+// defined, TIMER1 at clock/8 which allows up to 20000 Hz with 0.5uS resolution.
+
 // Init driver in preparation for calls to run_stepper().
 void init_stepper(void);
 
 // Given number of steps, (re)start the stepper. Step forward if steps > 0,
-// backwards if steps < 0, or stop if steps==0. If changing direction, may
-// block up to 16mS. Otherwise returns immediately. The stepper runs in
+// backwards if steps < 0, or stop if steps==0. If changing direction, blocks
+// while the stepper decelerates. Otherwise returns immediately. The stepper runs in
 // background and stops automatically when specified steps have been made. The
 // maximum value for steps is +/-32767, so the maximum run time is at least
 // 32767/STEPPER_FAST_HZ seconds. To prevent the motor from stopping just keep
@@ -33,4 +56,8 @@ void start_stepper(int16_t steps);
 void run_stepper(int16_t steps);
 
 // Return true if stepper is currently running
+#if defined(STEPPER_TIMER1) || defined(STEPPER_MICRO)
+#define running_stepper() (TIMSK1!=0)
+#else
 #define running_stepper() (TIMSK0!=0)
+#endif
@@ -0,0 +1,241 @@
+// TWI driver, supports master mode only. The TWI interrupt walks each
+// transaction through the hardware's status codes, and chains queued
+// transactions back-to-back with a STOP followed by a START.
+
+#ifndef TWI_HZ
+#define TWI_HZ 100000
+#endif
+
+#ifndef TWI_TIMEOUT
+#define TWI_TIMEOUT 25
+#endif
+
+// bit rate with prescaler 1, SCL = CPU/(16+2*TWBR)
+#define BITRATE (((MHZ*1000000UL)/TWI_HZ-16)/2)
+#if (MHZ*1000000UL)/TWI_HZ < 16 || BITRATE > 255
+#error "TWI_HZ not supported"
+#endif
+
+#define CONTROL ((1<<TWINT)|(1<<TWEN)|(1<<TWIE))
+
+// Transaction queue, the head is the transaction in progress
+static twi_xfer * volatile head, * volatile tail;
+
+static uint8_t *txd, *rxd, txc, rxc;
+static volatile uint8_t progress;       // incremented by each TWI event and transaction start
+static bool finishing;                  // true while a done() callback is running
+#ifdef THREAD
+static semaphore queued;                // released when the queue goes busy
+#endif
+
+// Load the transaction at the head of the queue, interrupts must be disabled
+static void load(void)
+{
+    twi_xfer *x=head;
+    txd=x->txdata; txc=x->txcount; rxd=x->rxdata; rxc=x->rxcount;
+    progress++;
+}
+
+// Start the transaction at the head of the queue from idle, interrupts must
+// be disabled
+static void start(void)
+{
+    while (TWCR & (1<<TWSTO));          // previous STOP must complete
+    load();
+    TWCR = CONTROL|(1<<TWSTA);
+}
+
+// Dequeue the head with status, then send STOP and maybe chain the next
+static void finish(uint8_t status)
+{
+    twi_xfer *x=head;
+    head=x->next;
+    x->status=status;
+    x->busy=0;
+    finishing=1;                        // submit_twi() must not start
+    if (x->done) x->done(x);            // tell the owner, which may submit more
+#ifdef THREAD
+    else release(&x->complete);         // or unblock waiting thread
+#endif
+    finishing=0;
+    if (head)
+    {
+        load();
+        TWCR = CONTROL|(1<<TWSTO)|(1<<TWSTA); // STOP then START
+    }
+    else TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWSTO);
+}
+
+ISR(TWI_vect)
+{
+    progress++;                         // the bus isn't stuck
+    switch (TWSR & 0xF8)
+    {
+        case 0x08:                      // START sent
+        case 0x10:                      // repeated START sent
+            TWDR = (head->address << 1) | (!txc && rxc); // read only if nothing to write
+            TWCR = CONTROL;
+            return;
+
+        case 0x18:                      // SLA+W ACKed
+        case 0x28:                      // data ACKed
+            if (txc)
+            {
+                TWDR = *txd++;
+                txc--;
+                TWCR = CONTROL;
+                return;
+            }
+            if (rxc)
+            {
+                TWCR = CONTROL|(1<<TWSTA); // repeated START to read
+                return;
+            }
+            finish(TWI_OK);
+            return;
+
+        case 0x50:                      // data received, ACK returned
+            *rxd++ = TWDR;
+            rxc--;
+            // fall through
+        case 0x40:                      // SLA+R ACKed
+            TWCR = CONTROL|((rxc > 1)<<TWEA); // NACK the last byte
+            return;
+
+        case 0x58:                      // last byte received, NACK returned
+            *rxd = TWDR;
+            finish(TWI_OK);
+            return;
+
+        case 0x20:                      // SLA+W NACKed
+        case 0x30:                      // data NACKed
+        case 0x48:                      // SLA+R NACKed
+            finish(TWI_NACK);
+            return;
+
+        case 0x38:                      // arbitration lost, retry when the bus is free
+            load();
+            TWCR = CONTROL|(1<<TWSTA);
+            return;
+
+        default:                        // bus error
+            finish(TWI_ERROR);
+            return;
+    }
+}
+
+// Queue a transaction and return true, or false if it's invalid or already
+// queued. The transaction starts immediately if the bus is idle.
+bool submit_twi(twi_xfer *x)
+{
+    if ((x->address > 127) || (x->txcount && !x->txdata) || (x->rxcount && !x->rxdata)) return 0;
+    uint8_t sreg=SREG;
+    cli();
+    if (x->busy)
+    {
+        SREG=sreg;
+        return 0;
+    }
+    x->busy=1;
+    x->next=NULL;
+    if (head) tail->next=x;             // append to queue
+    else
+    {
+        head=x;                         // or become the head
+        if (!finishing) start();        // and start now, unless finish() will
+#ifdef THREAD
+        release(&queued);               // wake the watchdog
+#endif
+    }
+    tail=x;
+    SREG=sreg;
+    return 1;
+}
+
+// Wait for a submitted transaction to complete
+void wait_twi(twi_xfer *x)
+{
+    sei();                              // make sure interrupts are enabled
+#ifdef THREAD
+    while (x->busy) suspend(&x->complete);
+#else
+    // no watchdog thread, so check for timeout here
+    uint8_t s=progress;
+    uint32_t t=get_ticks()+TWI_TIMEOUT;
+    while (x->busy)
+    {
+        if (progress != s)
+        {
+            s=progress;
+            t=get_ticks()+TWI_TIMEOUT;
+        }
+        else if (expired(t)) reset_twi();
+    }
+#endif
+}
+
+// Perform a single TWI transaction with the slave at 7-bit address, writing
+// txcount bytes from *txdata then reading rxcount bytes to *rxdata after a
+// repeated START. Either count can be 0, if both are then this just checks
+// that the slave ACKs its address.
+//
+// Returns TWI_OK, TWI_NACK, or TWI_ERROR.
+uint8_t xfer_twi(uint8_t address, uint8_t *txdata, uint8_t txcount, uint8_t *rxdata, uint8_t rxcount)
+{
+    twi_xfer x = { .address=address, .txdata=txdata, .txcount=txcount, .rxdata=rxdata, .rxcount=rxcount };
+    if (!submit_twi(&x)) return TWI_ERROR;
+    wait_twi(&x);
+    return x.status;
+}
+
+// Release the bus from a slave that's holding SDA low, by clocking SCL until
+// it lets go, then send a STOP. Fail the transaction in progress, if any.
+void reset_twi(void)
+{
+    uint8_t sreg=SREG;
+    cli();
+    TWCR = 0;                           // disable TWI, pins revert to GPIO
+    for (uint8_t n = 0; n < 9 && !GET_GPIO(TWI_SDA); n++)
+    {
+        CLR_GPIO(TWI_SCL); OUT_GPIO(TWI_SCL); // drive SCL low
+        waituS(5);
+        IN_GPIO(TWI_SCL); SET_GPIO(TWI_SCL); // release it to the pullup
+        waituS(5);
+    }
+    CLR_GPIO(TWI_SDA); OUT_GPIO(TWI_SDA); // SDA low then high while SCL is high
+    waituS(5);
+    IN_GPIO(TWI_SDA); SET_GPIO(TWI_SDA);
+    waituS(5);
+    TWCR = 1<<TWEN;
+    if (head) finish(TWI_ERROR);        // this also starts the next
+    SREG=sreg;
+}
+
+#ifdef THREAD
+// Reset the bus if it makes no progress for TWI_TIMEOUT mS
+THREAD(twiwatch, 80)
+{
+    while (1)
+    {
+        while (!head) suspend(&queued);
+        uint8_t s=progress;
+        sleep_ticks(TWI_TIMEOUT);
+        if (head && progress == s) reset_twi();
+    }
+}
+#endif
+
+// Initialize TWI
+void init_twi(void)
+{
+#ifdef THREAD
+    while (head) yield();               // let queued transactions finish
+#else
+    while (head);
+#endif
+    IN_GPIO(TWI_SDA); SET_GPIO(TWI_SDA); // inputs with pullups
+    IN_GPIO(TWI_SCL); SET_GPIO(TWI_SCL);
+    TWSR = 0;                           // prescaler 1
+    TWBR = BITRATE;
+    reset_twi();                        // in case a slave was left mid-byte
+}
@@ -0,0 +1,51 @@
+// TWI (aka I2C) driver, master mode. Define TWI_HZ in main.h as 100000 or
+// 400000 (default 100000). Uses the internal pullups, which are weak, so
+// external pullups are recommended at 400 kHz.
+
+// Transaction results
+#define TWI_OK 0                        // success
+#define TWI_NACK 1                      // slave didn't acknowledge address or data
+#define TWI_ERROR 2                     // bus error or timeout, the bus was reset
+
+// An asynchronous TWI transaction. The caller fills in the transfer
+// parameters and passes the struct to submit_twi(). txcount bytes are
+// written to the slave, then if rxcount is non-zero rxcount bytes are read
+// after a repeated start. With no data it just checks that the slave
+// acknowledges its address. The struct must remain valid until the
+// transaction completes.
+typedef struct twi_xfer
+{
+    struct twi_xfer *next;              // queue link, managed by the driver
+    uint8_t address;                    // 7-bit slave address
+    uint8_t *txdata, txcount;           // data to write
+    uint8_t *rxdata, rxcount;           // where to put data read
+    void (*done)(struct twi_xfer *x);   // if not NULL, called from the ISR on completion
+    volatile bool busy;                 // true while queued or in progress
+    uint8_t status;                     // TWI_OK etc, valid when complete
+#ifdef THREAD
+    semaphore complete;                 // released on completion (by done() if set)
+#endif
+} twi_xfer;
+
+// Init the TWI, and reset the bus in case a slave is stuck
+void init_twi(void);
+
+// Queue a transaction and return true, or return false if the transaction is
+// invalid or already queued. Can be called from an ISR, including from a
+// done() callback. Queued transactions are started back-to-back by the ISR.
+bool submit_twi(twi_xfer *x);
+
+// Wait for a submitted transaction to complete. If x->done is set, the
+// callback must release x->complete when it's finished with the transaction.
+void wait_twi(twi_xfer *x);
+
+// Return true if transaction is queued or in progress
+#define busy_twi(x) ((x)->busy)
+
+// Write txcount bytes to the slave then read rxcount bytes, return TWI_OK etc
+uint8_t xfer_twi(uint8_t address, uint8_t *txdata, uint8_t txcount, uint8_t *rxdata, uint8_t rxcount);
+
+// Reset the bus and fail the transaction in progress with TWI_ERROR. This is
+// done automatically if the bus makes no progress, no byte or other TWI event,
+// for TWI_TIMEOUT mS (default 25).
+void reset_twi(void);
@@ -0,0 +1,193 @@
+// TWI slave driver. The TWI interrupt handles the slave receiver and slave
+// transmitter status codes, reading registers from the published buffer and
+// writing control registers to a shadow copy.
+
+#ifndef TWI_SLAVE
+#error "Must define TWI_SLAVE"
+#endif
+#if TWI_SLAVE < 0x08 || TWI_SLAVE > 0x77
+#error "TWI_SLAVE must be 0x08 to 0x77"
+#endif
+
+#ifdef TWI_OK
+#error "twislave conflicts with twi"
+#endif
+
+#if TWI_REGISTERS + TWI_CONTROLS > 255
+#error "Too many TWI registers"
+#endif
+
+// respond to our address, ACK data
+#define CONTROL ((1<<TWINT)|(1<<TWEA)|(1<<TWEN)|(1<<TWIE))
+
+static uint8_t registers[2][TWI_REGISTERS];     // published and staging
+static volatile uint8_t published;              // index of buffer read by the master
+static volatile bool pending;                   // staging buffer is waiting to be published
+static volatile bool reading;                   // master is reading
+
+static uint8_t controls[TWI_CONTROLS];
+static uint8_t shadow[TWI_CONTROLS];            // written by the master
+static volatile bool written;                   // shadow has changed
+#ifdef THREAD
+static semaphore controlled;                    // released when controls change
+#else
+static volatile bool changed;
+#endif
+
+static uint8_t pointer;                         // current register
+static bool addressed;                          // pointer has been written
+
+// Publish the staging buffer and make a new one, interrupts must be disabled
+static void publish(void)
+{
+    published ^= 1;
+    memcpy(registers[!published], registers[published], TWI_REGISTERS);
+    pending = 0;
+}
+
+// Return register at the pointer and advance
+static uint8_t next(void)
+{
+    uint8_t p = pointer;
+    if (p < 0xFF) pointer++;
+    if (p < TWI_REGISTERS) return registers[published][p];
+    if (p < TWI_REGISTERS + TWI_CONTROLS) return controls[p - TWI_REGISTERS];
+    return 0xFF;
+}
+
+// End of a write or a read
+static void end(void)
+{
+    if (written)
+    {
+        memcpy(controls, shadow, TWI_CONTROLS);
+        written = 0;
+#ifdef THREAD
+        release(&controlled);
+#else
+        changed = 1;
+#endif
+    }
+    reading = 0;
+    if (pending) publish();
+}
+
+ISR(TWI_vect)
+{
+    switch (TWSR & 0xF8)
+    {
+        case 0x60:                              // SLA+W received
+        case 0x68:                              // after losing arbitration as master
+            addressed = 0;
+            memcpy(shadow, controls, TWI_CONTROLS);
+            break;
+
+        case 0x80:                              // data received, ACK returned
+        case 0x88:                              // data received, NACK returned
+        {
+            uint8_t d = TWDR;
+            if (!addressed)
+            {
+                pointer = d;                    // first byte is the register
+                addressed = 1;
+                break;
+            }
+            uint8_t c = pointer - TWI_REGISTERS;
+            if (pointer >= TWI_REGISTERS && c < TWI_CONTROLS)
+            {
+                shadow[c] = d;
+                written = 1;
+            }
+            if (pointer < 0xFF) pointer++;
+            break;
+        }
+
+        case 0xA0:                              // STOP or repeated START
+            end();
+            break;
+
+        case 0xA8:                              // SLA+R received
+        case 0xB0:                              // after losing arbitration as master
+            reading = 1;
+            // fall through
+        case 0xB8:                              // data sent, ACK received
+            TWDR = next();
+            break;
+
+        case 0xC0:                              // data sent, NACK received
+        case 0xC8:                              // last data sent, ACK received
+            end();
+            break;
+
+        default:                                // bus error
+            TWCR = CONTROL|(1<<TWSTO);
+            end();
+            return;
+    }
+    TWCR = CONTROL;
+}
+
+// Stage count bytes from data to read-only registers starting at reg
+void set_twislave(uint8_t reg, void *data, uint8_t count)
+{
+    if (reg >= TWI_REGISTERS) return;
+    if (count > TWI_REGISTERS - reg) count = TWI_REGISTERS - reg;
+    sei();
+#ifdef THREAD
+    while (pending) yield();                    // previous commit is waiting for a read to end
+#else
+    while (pending);
+#endif
+    memcpy(&registers[!published][reg], data, count);
+}
+
+// Publish staged registers, now if the master isn't reading, or else at the
+// end of the read
+void commit_twislave(void)
+{
+    uint8_t sreg = SREG;
+    cli();
+    if (reading) pending = 1;
+    else publish();
+    SREG = sreg;
+}
+
+// Copy count control registers starting at control to data
+void get_twislave(uint8_t control, void *data, uint8_t count)
+{
+    if (control >= TWI_CONTROLS) return;
+    if (count > TWI_CONTROLS - control) count = TWI_CONTROLS - control;
+    uint8_t sreg = SREG;
+    cli();
+    memcpy(data, &controls[control], count);
+    SREG = sreg;
+}
+
+#ifdef THREAD
+// Suspend until the master writes control registers
+void wait_twislave(void)
+{
+    suspend(&controlled);
+}
+#else
+// Return true once after the master writes control registers
+bool changed_twislave(void)
+{
+    if (!changed) return 0;
+    changed = 0;
+    return 1;
+}
+#endif
+
+// Init TWI in slave mode
+void init_twislave(void)
+{
+    TWCR = 0;
+    memset(registers, 0, sizeof registers);
+    memset(controls, 0, sizeof controls);
+    published = pending = reading = written = 0;
+    IN_GPIO(TWI_SDA); SET_GPIO(TWI_SDA);        // inputs with pullups
+    IN_GPIO(TWI_SCL); SET_GPIO(TWI_SCL);
+    TWAR = TWI_SLAVE << 1;                      // no general call
+    TWCR = CONTROL;
+}
@@ -0,0 +1,54 @@
+// TWI (aka I2C) slave driver, exposes a register file to a TWI master. Uses the
+// TWI hardware, so can't be used with the twi master driver.
+//
+// Define in main.h:
+//      TWI_SLAVE - the 7-bit slave address
+//      TWI_REGISTERS - number of read-only registers, published by the
+//          application, default 16
+//      TWI_CONTROLS - number of read/write control registers, set by the
+//          master, which follow the read-only registers, default 4
+//
+// The master writes a register number as the first byte of a write
+// transaction, then any further bytes are written to consecutive control
+// registers. A read transaction returns consecutive registers starting from
+// the last register number, so a write of one byte then a repeated START
+// reads a burst from any register. Registers past the end read as 0xFF.
+//
+// Reads are served by the interrupt without involving the application.
+// Register values are double buffered: the application writes into a
+// staging copy with set_twislave() and publishes all changes at once with
+// commit_twislave(), so the master never sees a partly updated multi-byte
+// value. A commit during a read takes effect when the read ends. Similarly
+// control register writes take effect together at the end of the write.
+//
+// Note the TWI hardware stretches SCL while the interrupt is delayed, so
+// drivers that disable interrupts for a long time slow the bus but don't
+// corrupt transfers, if the master supports clock stretching.
+
+#ifndef TWI_REGISTERS
+#define TWI_REGISTERS 16
+#endif
+
+#ifndef TWI_CONTROLS
+#define TWI_CONTROLS 4
+#endif
+
+// Start responding to TWI_SLAVE, all registers are 0
+void init_twislave(void);
+
+// Stage count bytes from data to read-only registers starting at reg
+void set_twislave(uint8_t reg, void *data, uint8_t count);
+
+// Publish staged registers to the master
+void commit_twislave(void);
+
+// Copy count control registers starting at control (numbered from 0) to data
+void get_twislave(uint8_t control, void *data, uint8_t count);
+
+#ifdef THREAD
+// Suspend until the master writes control registers
+void wait_twislave(void);
+#else
+// Return true once after the master writes control registers
+bool changed_twislave(void);
+#endif
@@ -0,0 +1,77 @@
+// IR transmit and learn demo. The IR LED driver attaches to GPIO05 and the IR
+// detector to GPIO08.
+
+#define LED GPIO13                              // on-board LED
+
+static irtemplate learned;
+
+COMMAND(send, NULL, "send NEC code")
+{
+    if (argc < 2 || argc > 3) die("Usage: send code [repeats]\n");
+    uint32_t code = strtoul(argv[1], NULL, 16);
+    uint8_t repeats = (argc == 3) ? strtoul(argv[2], NULL, 0) : 0;
+    if (!send_irtx(code, repeats)) die("Queue is full\n");
+}
+
+COMMAND(learn, NULL, "learn a frame from an IR remote")
+{
+    int8_t r = 0;
+    raw_nec(1);
+    pprintf("Press a remote button, or any key to stop\n");
+    while (!readable_serial() && (r = learn_nec(&learned)) <= 0)
+    {
+        if (r < 0) pprintf("Frame is too complex, try again\n");
+        sleep_ticks(1);
+    }
+    raw_nec(0);
+    if (r <= 0)
+    {
+        read_serial();
+        learned.count = 0;
+        die("Stopped\n");
+    }
+    pprintf("Learned %d pulses with widths:", learned.count);
+    for (uint8_t i = 0; i < learned.widths; i++) pprintf(" %u", learned.width[i]);
+    pprintf("\n");
+}
+
+COMMAND(replay, NULL, "replay the learned frame")
+{
+    if (argc > 2) die("Usage: replay [repeats]\n");
+    if (!learned.count) die("Nothing learned\n");
+    uint8_t repeats = (argc == 2) ? strtoul(argv[1], NULL, 0) : 0;
+    if (!replay_irtx(&learned, repeats, 40)) die("Queue is full\n");
+    wait_irtx();
+}
+
+// show decoded keys while idle
+THREAD(keys,100)
+{
+    while (true)
+    {
+        irkey key;
+        int8_t event = get_nec(&key);
+        if (event) pprintf("%7s: protocol=%d code=%08lX\n", (event>0)?"Press":"Release", key.proto, key.code);
+        sleep_ticks(2);
+    }
+}
+
+THREAD(blink,65)
+{
+    OUT_GPIO(LED);
+    while(true)
+    {
+        TOG_GPIO(LED);
+        sleep_ticks(200);
+    }
+}
+
+int main(void)
+{
+    init_serial();
+    init_nec();
+    init_irtx();
+    pprintf("IR transmit demo\n");
+    start_threads();
+    command(">");
+}
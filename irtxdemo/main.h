@@ -0,0 +1,3 @@
+#define BOARD "uno_r3.h"
+#define TICKMS 8
+#define NEC_RAW 128
@@ -1,3 +1,4 @@
 #define BOARD "uno_r3.h"
 #define TICKMS 8
 #define DEBUG_STACKS
+#define LCD_BUFFER
@@ -0,0 +1,111 @@
+// MDIO demo, monitors link state of two phys and provides the mdio command
+
+static phy phys[] = { {0}, {1} };
+#define PHYS (sizeof(phys)/sizeof(phy))
+
+// link status, and speed and duplex as set by autonegotiation or forced
+static mdio_watch watches[] = {
+    { &phys[0], 1, 0x0004 },                    // BMSR link status
+    { &phys[0], 0, 0x2140 },                    // BMCR speed and duplex
+    { &phys[1], 1, 0x0004 },
+    { &phys[1], 0, 0x2140 },
+};
+#define WATCHES (sizeof(watches)/sizeof(mdio_watch))
+
+#define PERIOD 500                              // default watch period in ticks
+
+// Print a logged change
+static void show(mdio_change *c)
+{
+    mdio_watch *w = &watches[c->watch];
+    pprintf("%lu: phy %d reg 0x%lX %04X -> %04X\n", c->ticks, w->p->addr, w->reg, c->from, c->to);
+}
+
+// Log changes as they happen
+THREAD(logger, 100)
+{
+    uint8_t position = 0;
+    while (true)
+    {
+        mdio_change c;
+        while (next_mdio(&position, &c)) show(&c);
+        wait_mdio();
+    }
+}
+
+// Return the phy with address given by arg. Use the monitored one if there is
+// one, since the driver caches the last clause45 address sent to each phy.
+static phy *lookup(char *arg, phy *temp)
+{
+    uint8_t addr = strtoul(arg,NULL,0);
+    for (uint8_t i = 0; i < PHYS; i++)
+        if (phys[i].addr == addr) return &phys[i];
+    *temp = (phy){ addr };
+    return temp;
+}
+
+COMMAND(mdio, NULL, "read, write, dump or watch phy registers")
+{
+    if (argc >= 4 && !strcmp(argv[1], "read"))
+    {
+        phy t, *p = lookup(argv[2], &t);
+        for (uint8_t n = 3; n < argc; n++)
+        {
+            int32_t reg = strtol(argv[n],NULL,0);
+            pprintf("%04X\n", read_mdio(p, reg));
+        }
+        return;
+    }
+    if (argc == 5 && !strcmp(argv[1], "write"))
+    {
+        phy t, *p = lookup(argv[2], &t);
+        write_mdio(p, strtol(argv[3],NULL,0), (uint16_t)strtoul(argv[4],NULL,0));
+        return;
+    }
+    if (argc == 5 && !strcmp(argv[1], "dump"))
+    {
+        phy t, *p = lookup(argv[2], &t);
+        int32_t reg = strtol(argv[3],NULL,0);
+        uint16_t count = strtoul(argv[4],NULL,0);
+        while (count)
+        {
+            uint16_t data[8];
+            uint8_t n = (count < 8) ? count : 8;
+            dump_mdio(p, reg, data, n);
+            pprintf("%06lX:", reg);
+            for (uint8_t i = 0; i < n; i++) pprintf(" %04X", data[i]);
+            pprintf("\n");
+            reg += n;
+            count -= n;
+        }
+        return;
+    }
+    if ((argc == 2 || argc == 3) && !strcmp(argv[1], "watch"))
+    {
+        if (argc == 3)
+        {
+            uint16_t period = strtoul(argv[2],NULL,0);
+            monitor_mdio(watches, period ? WATCHES : 0, period);
+        }
+        for (uint8_t i = 0; i < WATCHES; i++)
+            pprintf("phy %d reg 0x%lX mask %04X = %04X\n", watches[i].p->addr, watches[i].reg, watches[i].mask, watches[i].value);
+        uint8_t position = 0;
+        mdio_change c;
+        while (next_mdio(&position, &c)) show(&c);
+        return;
+    }
+    die("Usage:\n"
+        "  mdio read phy reg [... reg]\n"
+        "  mdio write phy reg value\n"
+        "  mdio dump phy reg count\n"
+        "  mdio watch [period] -- show watched registers and log, set period in ticks or 0 to stop\n");
+}
+
+int main(void)
+{
+    init_serial();
+    monitor_mdio(watches, WATCHES, PERIOD);
+    pprintf("MDIO demo\n");
+    start_threads();
+    command(">");
+}
@@ -0,0 +1,8 @@
+#define BOARD "uno_r3.h"
+#define TICKMS 8
+
+// static pins for speed
+#define MDIO_MDC GPIO02
+#define MDIO_MDIO GPIO03
+
+#define MDIO_MONITOR
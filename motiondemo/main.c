@@ -0,0 +1,57 @@
+// Motion demo
+
+#define AXES 3
+
+COMMAND(move, NULL, "move to absolute position")
+{
+    if (argc < AXES+1 || argc > AXES+2) die("Usage: move x y z [hz]\n");
+    int32_t target[AXES];
+    for (uint8_t a = 0; a < AXES; a++) target[a] = strtol(argv[a+1],NULL,0);
+    uint16_t hz = (argc == AXES+2) ? (uint16_t)strtoul(argv[AXES+1],NULL,0) : 2000;
+    move_motion(target, hz);
+}
+
+COMMAND(where, NULL, "show current position")
+{
+    pprintf("%ld %ld %ld%s\n", get_motion(0), get_motion(1), get_motion(2), running_motion() ? " running" : "");
+}
+
+COMMAND(zero, NULL, "set current position to 0")
+{
+    wait_motion();
+    zero_motion();
+}
+
+// 16 points on a circle of radius 1000, starting after {1000,0}
+static const int16_t circle[16][2] = {
+    {924,383}, {707,707}, {383,924}, {0,1000},
+    {-383,924}, {-707,707}, {-924,383}, {-1000,0},
+    {-924,-383}, {-707,-707}, {-383,-924}, {0,-1000},
+    {383,-924}, {707,-707}, {924,-383}, {1000,0}
+};
+
+COMMAND(circle, NULL, "trace a circle in X and Y")
+{
+    if (argc > 3) die("Usage: circle [radius [hz]]\n");
+    int32_t r = (argc > 1) ? strtol(argv[1],NULL,0) : 1000;
+    uint16_t hz = (argc > 2) ? (uint16_t)strtoul(argv[2],NULL,0) : 4000;
+    wait_motion();
+    int32_t cx = get_motion(0) - r, cy = get_motion(1);
+
+    // the chords join without stopping
+    for (uint8_t i = 0; i < 16; i++)
+    {
+        int32_t target[AXES] = { cx + r * circle[i][0] / 1000, cy + r * circle[i][1] / 1000, get_motion(2) };
+        move_motion(target, hz);
+    }
+    wait_motion();
+}
+
+int main(void)
+{
+    init_serial();
+    init_motion();
+    pprintf("Motion demo\n");
+    start_threads();
+    command(">");
+}
@@ -0,0 +1,8 @@
+#define BOARD "uno_r3.h"
+#define TICKMS 8
+
+// X and Y on STEP/DIR drivers, Z on a unipolar motor
+#define MOTION_AXES MOTION_STEPDIR(GPIO02, GPIO05), \
+                    MOTION_STEPDIR(GPIO03, GPIO06), \
+                    MOTION_UNIPOLAR(GPIO08, GPIO09, GPIO10, GPIO11)
+#define MOTION_ACCEL 4000
@@ -1,4 +1,4 @@
-// NEC IR receive demo, note this is non-threaded
+// IR receive demo, note this is non-threaded
 
 #define LED GPIO13                              // on-board LED
 
@@ -10,14 +10,21 @@ int main(void)
     init_nec();
 
     pprintf("Waiting for IR...\n");
+    uint32_t pressed = 0;
     while(true)
     {
         int8_t event;
-        uint32_t key;
+        irkey key;
 
-        sleep_ticks(100);
         TOG_GPIO(LED);
-        if ((event=get_nec(&key))!=0)
-            pprintf("%7s: vendor=%04X key=%02X check=%02X\n", (event>0)?"Press":"Release",NEC_VENDOR(key), NEC_KEY(key), NEC_CHECK(key));
+        if ((event=wait_nec(&key, 100))!=0)
+        {
+            if (event > 0) pressed = key.time;
+            else pprintf("Held for %lu ticks\n", key.time - pressed);
+            if (key.proto == IR_NEC)
+                pprintf("%7s: vendor=%04X key=%02X check=%02X\n", (event>0)?"Press":"Release",NEC_VENDOR(key.code), NEC_KEY(key.code), NEC_CHECK(key.code));
+            else
+                pprintf("%7s: protocol=%d code=%08lX\n", (event>0)?"Press":"Release", key.proto, key.code);
+        }
     }
 }
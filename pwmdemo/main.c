@@ -10,10 +10,12 @@ THREAD(pwmled,65)
     while (1)
     {
         suspend(&pwm_mutex); // block here while console holds the mutex
+        begin_pwm();         // all outputs change in the same period
         set_pwm0(phases[phase]);
         set_pwm1(phases[(phase+1) % sizeof phases]);
         set_pwm2(phases[(phase+2) % sizeof phases]);
         set_pwm3(phases[(phase+3) % sizeof phases]);
+        commit_pwm();
         phase=(phase+1) % sizeof(phases);
         release(&pwm_mutex);
         sleep_ticks(60);
@@ -60,6 +62,41 @@ COMMAND(freq,  NULL, "set PWM 2/3 frequency")
     pprintf("setting pwm freq = %u, actual = %u\n", freq, set_timer1_freq(freq));
 }
 
+COMMAND(phase, NULL, "set PWM 2/3 phase correct mode")
+{
+    if (argc != 3) die("Usage: phase 0|1 freq\n");
+    bool enable=strtoul(argv[1],NULL,0);
+    uint16_t freq=(uint16_t)strtoul(argv[2],NULL,0);
+    pprintf("setting pwm phase correct = %d, freq = %u, actual = %u, top = %u\n", enable, freq, set_timer1_phase(enable, freq), get_timer1_top());
+}
+
+COMMAND(duty, NULL, "set PWM 2/3 16-bit pulse width")
+{
+    if (argc != 3) die("Usage: duty pwm 0-top\n");
+    uint8_t pwm=(uint8_t)strtoul(argv[1],NULL,0);
+    uint16_t width=(uint16_t)strtoul(argv[2],NULL,0);
+    if (!hasmutex) suspend(&pwm_mutex), hasmutex=1;
+    switch (pwm)
+    {
+        case 2: set_pwm2_16(width); break;
+        case 3: set_pwm3_16(width); break;
+        default: die("Only PWM 2 and 3\n");
+    }
+    pprintf("Setting pwm %d = %u of %u\n", pwm, width, get_timer1_top());
+}
+
+COMMAND(fade, NULL, "fade a PWM")
+{
+    if (argc < 4 || argc > 5) die("Usage: fade pwm 0-255 mS [gamma]\n");
+    uint8_t pwm=(uint8_t)strtoul(argv[1],NULL,0);
+    uint8_t target=(uint8_t)strtoul(argv[2],NULL,0);
+    uint16_t ms=(uint16_t)strtoul(argv[3],NULL,0);
+    if (!hasmutex) suspend(&pwm_mutex), hasmutex=1;
+    fade_pwm(pwm, target, ms, (argc == 5) ? PWM_GAMMA : PWM_LINEAR);
+    wait_pwm(pwm);
+    pprintf("Faded pwm %d to %d\n", pwm, target);
+}
+
 COMMAND(width, NULL, "set a PWM pulse width percent")
 {
     if (argc != 3) die("Usage: width pwm percent\n");
@@ -76,6 +113,19 @@ COMMAND(width, NULL, "set a PWM pulse width percent")
     }
 }
 
+COMMAND(widths, NULL, "set all PWM pulse widths at once")
+{
+    if (argc != 5) die("Usage: widths w0 w1 w2 w3\n");
+    if (!hasmutex) suspend(&pwm_mutex), hasmutex=1;
+    begin_pwm();
+    set_pwm0((int16_t)strtol(argv[1],NULL,0));
+    set_pwm1((int16_t)strtol(argv[2],NULL,0));
+    set_pwm2((int16_t)strtol(argv[3],NULL,0));
+    set_pwm3((int16_t)strtol(argv[4],NULL,0));
+    commit_pwm();
+    pprintf("Committed\n");
+}
+
 THREAD(blink,65)
 {
     OUT_GPIO(LED);                  // Make the LED an output
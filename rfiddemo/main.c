@@ -14,33 +14,29 @@ int main(void)
     }
     pprintf("Ready for card swipe!\n");
 
+    bool held = false;
     while(1)
     {
-        sleep_ticks(100);
-        TOG_GPIO(LED);
+        sleep_ticks(20);
 
-        uint8_t uid[10];
-        int8_t got=get_mfrc522(uid);
-        switch(got)
+        // Collect all new cards in the field. Cards already reported are
+        // halted and don't answer again until they leave the field.
+        rfid cards[4];
+        int8_t got=inventory_mfrc522(cards, 4);
+        for (int8_t n=0; n < got; n++)
         {
-            // 0 means no card, that's normal so say nothing
-            case 0:
-                break;
-
-            // 4, 7, or 10 is UID length in bytes, report it.
-            case 4:
-            case 7:
-            case 10:
-                pprintf("Got UID ");
-                for (int i=0; i < got; i++) pprintf("%02X", uid[i]);
-                pprintf("\n");
-                break;
+            TOG_GPIO(LED);
+            pprintf("Got UID ");
+            for (int i=0; i < cards[n].size; i++) pprintf("%02X", cards[n].uid[i]);
+            pprintf("\n");
+            held = true;
+        }
 
-            // Error status is also normal and in real life would not report
-            // it, but for this demo we'll be verbose.
-            default:
-                pprintf("Got error %d\n", got);
-                break;
+        // Otherwise check if the last card is still there
+        if (!got && held && !present_mfrc522())
+        {
+            pprintf("Card removed\n");
+            held = false;
         }
     }
 }
@@ -9,3 +9,4 @@
 
 // RFID definitions
 #define MFRC522_RST GPIO09
+//#define MFRC522_IRQ GPIO08 // if IRQ pin is connected
@@ -0,0 +1,38 @@
+// Servo demo
+
+COMMAND(set, NULL, "set a servo's pulse width")
+{
+    if (argc != 3) die("Usage: set servo uS\n");
+    uint8_t servo=(uint8_t)strtoul(argv[1],NULL,0);
+    uint16_t us=(uint16_t)strtoul(argv[2],NULL,0);
+    set_servo(servo, us);
+}
+
+COMMAND(move, NULL, "move a servo smoothly")
+{
+    if (argc != 4) die("Usage: move servo uS mS\n");
+    uint8_t servo=(uint8_t)strtoul(argv[1],NULL,0);
+    uint16_t us=(uint16_t)strtoul(argv[2],NULL,0);
+    uint16_t ms=(uint16_t)strtoul(argv[3],NULL,0);
+    move_servo(servo, us, ms);
+    wait_servo(servo);
+    pprintf("Moved servo %d to %d uS\n", servo, us);
+}
+
+COMMAND(sweep, NULL, "sweep all servos end to end")
+{
+    for (uint8_t s = 0; s < 8; s++) set_servo(s, 1500);
+    for (uint8_t s = 0; s < 8; s++) move_servo(s, (s & 1) ? 1000 : 2000, 500 + s*250);
+    for (uint8_t s = 0; s < 8; s++) wait_servo(s);
+    for (uint8_t s = 0; s < 8; s++) move_servo(s, 1500, 1000);
+    for (uint8_t s = 0; s < 8; s++) wait_servo(s);
+}
+
+int main(void)
+{
+    init_serial();
+    init_servo();
+    pprintf("Servo demo\n");
+    start_threads();
+    command(">");
+}
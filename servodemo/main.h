@@ -0,0 +1,6 @@
+#define BOARD "uno_r3.h"
+#define TICKMS 8
+
+// eight servos on three ports
+#define SERVO_PINS {GPIO02}, {GPIO03}, {GPIO04}, {GPIO05}, {GPIO06}, {GPIO07}, \
+                   {GPIOA0}, {GPIOA1}
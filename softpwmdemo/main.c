@@ -0,0 +1,23 @@
+// Software PWM demo
+
+COMMAND(set, NULL, "set a channel's duty")
+{
+    if (argc != 3) die("Usage: set channel 0-1024\n");
+    uint8_t channel=(uint8_t)strtoul(argv[1],NULL,0);
+    uint16_t duty=(uint16_t)strtoul(argv[2],NULL,0);
+    set_softpwm(channel, duty);
+}
+
+COMMAND(ramp, NULL, "set channels to increasing duty")
+{
+    for (uint8_t c = 0; c < 12; c++) set_softpwm(c, (uint16_t)c * 1024 / 11);
+}
+
+int main(void)
+{
+    init_serial();
+    init_softpwm();
+    pprintf("Software PWM demo\n");
+    start_threads();
+    command(">");
+}
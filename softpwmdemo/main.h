@@ -0,0 +1,7 @@
+#define BOARD "uno_r3.h"
+#define TICKMS 8
+
+// twelve channels on three ports
+#define SOFTPWM_PINS {GPIO02}, {GPIO03}, {GPIO04}, {GPIO05}, {GPIO06}, {GPIO07}, \
+                     {GPIO08}, {GPIO09}, {GPIO10}, {GPIOA0}, {GPIOA1}, {GPIOA2}
+#define SOFTPWM_BITS 10
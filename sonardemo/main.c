@@ -0,0 +1,21 @@
+// Sonar demo, print the distance table after each sweep
+
+static const char * const names[] = { "front", "right", "back", "left" };
+
+int main(void)
+{
+    init_serial();
+    init_sonar();
+    start_threads();
+    while (true)
+    {
+        wait_sonar();
+        for (uint8_t n = 0; n < 4; n++)
+        {
+            sonar_reading r;
+            get_sonar(n, &r);
+            pprintf("%s=%d@%lu ", names[n], r.cm, r.ticks);
+        }
+        pprintf("\n");
+    }
+}
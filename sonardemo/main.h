@@ -0,0 +1,7 @@
+#define BOARD "uno_r3.h"
+#define TICKMS 1
+
+// four sensors, front and back fire together, then left and right, echoes
+// on port B
+#define SONAR_SENSORS SONAR(0, GPIO02, GPIO08), SONAR(1, GPIO03, GPIO09), \
+                      SONAR(0, GPIO04, GPIO10), SONAR(1, GPIO05, GPIO11)
@@ -1,4 +1,4 @@
 #define BOARD "uno_r3.h"
 
-#define TICKMS 16 // sr04 driver can turn off interrupts up to 26mS
+#define TICKMS 1
 
@@ -0,0 +1,46 @@
+// TWI demo, for example with a 24C256 EEPROM at address 0x50
+
+static const char * const results[] = { "OK", "NACK", "bus error" };
+
+COMMAND(scan, NULL, "list addresses of slaves on the bus")
+{
+    for (uint8_t a = 0x08; a < 0x78; a++)
+        if (xfer_twi(a, NULL, 0, NULL, 0) == TWI_OK) pprintf("Found 0x%02X\n", a);
+}
+
+COMMAND(read, NULL, "read bytes from 16-bit EEPROM address")
+{
+    if (argc != 4) die("Usage: read slave address count\n");
+    uint8_t slave=(uint8_t)strtoul(argv[1],NULL,0);
+    uint16_t address=(uint16_t)strtoul(argv[2],NULL,0);
+    uint8_t count=(uint8_t)strtoul(argv[3],NULL,0);
+    if (!count || count > 64) die("Count must be 1 to 64\n");
+    uint8_t tx[2] = { address >> 8, address };
+    uint8_t rx[64];
+    uint8_t r=xfer_twi(slave, tx, 2, rx, count);
+    if (r) die("Failed: %s\n", results[r]);
+    for (uint8_t n = 0; n < count; n++) pprintf("%02X%c", rx[n], ((n & 15) == 15 || n == count-1) ? '\n' : ' ');
+}
+
+COMMAND(write, NULL, "write bytes to 16-bit EEPROM address")
+{
+    if (argc < 4 || argc > 19) die("Usage: write slave address byte [... byte]\n");
+    uint8_t slave=(uint8_t)strtoul(argv[1],NULL,0);
+    uint16_t address=(uint16_t)strtoul(argv[2],NULL,0);
+    uint8_t tx[18] = { address >> 8, address };
+    for (uint8_t n = 3; n < argc; n++) tx[n-1]=(uint8_t)strtoul(argv[n],NULL,0);
+    uint8_t r=xfer_twi(slave, tx, argc-1, NULL, 0);
+    if (r) die("Failed: %s\n", results[r]);
+    // the EEPROM NACKs its address until the write cycle is done
+    while (xfer_twi(slave, NULL, 0, NULL, 0) == TWI_NACK);
+    pprintf("Wrote %d bytes\n", argc-3);
+}
+
+int main(void)
+{
+    init_serial();
+    init_twi();
+    pprintf("TWI demo\n");
+    start_threads();
+    command(">");
+}
@@ -0,0 +1,4 @@
+#define BOARD "uno_r3.h"
+#define TICKMS 8
+
+#define TWI_HZ 400000
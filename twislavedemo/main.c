@@ -0,0 +1,72 @@
+// TWI slave demo, a sensor node that a master can poll.
+//
+// Read-only registers, 16-bit values are little-endian:
+//      0-7     a2d channels 0 to 3, 10-bit
+//      8       DHT11 degrees C
+//      9       DHT11 relative humidity
+//      10      DHT11 error of the last read, 0 if good
+//      11-12   SR04 distance in cm, -1 or -2 on error
+//      13      incremented each time registers are published
+// Control registers:
+//      16      LED, 0 = off, else on
+//      17      sample interval in 10 mS units, 0 = default 250 mS
+//
+// For example from a Raspberry Pi, "i2cset -y 1 0x42 16 1" turns on the LED
+// and "i2cget -y 1 0x42 11 w" reads the distance.
+
+#define LED GPIO13                              // on-board LED
+
+dht sensor = { .pin=(gpio []){{GPIO02}}, .type=DHT11 };
+
+gpio trig = {GPIO04},
+     echo = {GPIO05};
+
+static uint8_t interval;
+
+// Apply control registers written by the master
+THREAD(controls, 64)
+{
+    while (true)
+    {
+        wait_twislave();
+        uint8_t c[2];
+        get_twislave(0, c, 2);
+        if (c[0]) SET_GPIO(LED); else CLR_GPIO(LED);
+        interval = c[1];
+    }
+}
+
+int main(void)
+{
+    OUT_GPIO(LED);
+    init_twislave();
+    init_dht(&sensor);                          // sampled in the background
+    start_threads();
+
+    uint8_t count = 0;
+    while (true)
+    {
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            uint16_t v = get_a2d((struct a2d []){{i, false, false}});
+            set_twislave(i*2, &v, 2);
+        }
+
+        int16_t t;
+        uint16_t rh;
+        if (get_dht(&sensor, &t, &rh))
+        {
+            uint8_t d[2] = { t/10, rh/10 };
+            set_twislave(8, d, 2);
+        }
+        set_twislave(10, &sensor.error, 1);
+
+        int16_t cm = get_sr04(&trig, &echo);
+        set_twislave(11, &cm, 2);
+
+        count++;
+        set_twislave(13, &count, 1);
+        commit_twislave();
+        sleep_ticks(interval ? interval*10 : 250);
+    }
+}
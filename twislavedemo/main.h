@@ -0,0 +1,6 @@
+#define BOARD "uno_r3.h"
+#define TICKMS 1
+
+#define TWI_SLAVE 0x42
+#define TWI_REGISTERS 16
+#define TWI_CONTROLS 2